@@ -45,8 +45,7 @@ fi
 #-------------------------------------------------------------------------------
 if [ $STEP_RUN_C2S ] ; then
 cd $BLD_DIR  # it should be $BIN_DIR otherwise there is no point in doing make install
-time ./cpp2sqlite --verbose --lang=fr --inDir $SRC_DIR/input&
-time ./cpp2sqlite --verbose --inDir $SRC_DIR/input&
+time ./cpp2sqlite --verbose --lang=de,fr --zip --inDir $SRC_DIR/input
 fi
 
 #-------------------------------------------------------------------------------
@@ -8,6 +8,8 @@
 //
 
 #include <set>
+#include <unordered_map>
+#include <atomic>
 #include <iomanip>
 #include <sstream>
 #include <libgen.h>     // for basename()
@@ -20,13 +22,25 @@
 #include "gtin.hpp"
 //#include "swissmedic.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 namespace pt = boost::property_tree;
 
 namespace BAG
 {
     PreparationList prepList;
-    PackageMap packMap;
+
+    // Prices and flags of a pack, formatted once by parseXML()
+    // The category is not included, it's given by the caller
+    struct PackPrices {
+        std::string prices;     // "EFP x, PP y"
+        std::string flags;      // to be appended to the category
+        packageFields fields;   // flags without the category
+    };
+
+    // Built by parseXML(), read-only afterwards
+    std::unordered_map<std::string, std::vector<size_t>> swissmedNoMap; // preparations, in file order
+    std::unordered_map<std::string, PackPrices> packPricesMap;           // first pack with the GTIN
     
     // Parse-phase stats
     unsigned int statsPackCount = 0;
@@ -36,7 +50,7 @@ namespace BAG
     std::vector<std::string> statsSm8EmptyVec;
  
     // Usage stats
-    unsigned int statsTotalGtinCount = 0;
+    std::atomic<unsigned int> statsTotalGtinCount{0};
 
 static
 void printFileStats(const std::string &filename)
@@ -72,20 +86,82 @@ void printUsageStats()
     REP::html_end_ul();
 }
 
+static PackPrices formatPackPrices(const Preparation &pre, const Pack &p)
+{
+    PackPrices pp;
+    std::vector<std::string> flagsVector;
+
+    // Prices
+    if (!p.exFactoryPrice.empty()) {
+        pp.prices += "EFP " + p.exFactoryPrice;
+        pp.fields.efp = p.exFactoryPrice;
+    }
+
+    if (!p.publicPrice.empty()) {
+        pp.prices += ", PP " + p.publicPrice;
+        pp.fields.pp = p.publicPrice;
+    }
+
+    if (!p.exFactoryPriceValidFrom.empty()) { // for pharma.csv
+        pp.fields.efp_validFrom = p.exFactoryPriceValidFrom;
+    }
+
+    // Flags
+    if (!p.exFactoryPrice.empty() || !p.publicPrice.empty())
+        flagsVector.push_back("SL");  // TODO: localize to LS for French
+
+    if (!p.limitationPoints.empty())
+        flagsVector.push_back("LIM" + p.limitationPoints);
+
+    // SB: Selbstbehalt
+    if (pre.sb20 == "Y")
+        flagsVector.push_back("SB 20%");
+    else if (pre.sb20 == "N")
+        flagsVector.push_back("SB 10%");
+
+    if (!pre.orgen.empty())
+        flagsVector.push_back(pre.orgen);
+
+    pp.flags = boost::algorithm::join(flagsVector, ", ");
+    pp.fields.flags = flagsVector;
+    return pp;
+}
+
+static void buildIndexes()
+{
+    for (size_t i = 0; i < prepList.size(); i++) {
+        const Preparation &pre = prepList[i];
+        swissmedNoMap[pre.swissmedNo].push_back(i);
+
+        for (const Pack &p : pre.packs)
+            if (packPricesMap.find(p.gtin) == packPricesMap.end())
+                packPricesMap.emplace(p.gtin, formatPackPrices(pre, p));
+    }
+}
+
+// "de" -> "De", as in <NameDe>
+static std::string getTagSuffix(const std::string &language)
+{
+    std::string lan = language;
+    lan[0] = toupper(lan[0]);
+    return lan;
+}
+
 void parseXML(const std::string &filename,
-              const std::string &language,
+              const std::vector<std::string> &languages,
               bool verbose)
 {
     pt::ptree tree;
     
-    std::string lan = language;
-    lan[0] = toupper(lan[0]);
-    const std::string descriptionTag = "Description" + lan;
-    const std::string nameTag = "Name" + lan;
+    // Only for the report
+    const std::string descriptionTag = "Description" + getTagSuffix(languages[0]);
+    const std::string nameTag = "Name" + getTagSuffix(languages[0]);
 
     try {
         std::clog << std::endl << "Reading bag XML" << std::endl;
-        pt::read_xml(filename, tree);
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        pt::read_xml(stream, tree);
     }
     catch (std::exception &e) {
         std::cerr << "Line: " << __LINE__ << " Error " << e.what() << std::endl;
@@ -98,12 +174,14 @@ void parseXML(const std::string &filename,
             if (v.first == "Preparation") {
 
                 Preparation prep;
-                prep.name = v.second.get(nameTag, "");
-                prep.name = boost::to_upper_copy<std::string>(prep.name);
+                for (auto language : languages) {
+                    std::string name = v.second.get("Name" + getTagSuffix(language), "");
+                    prep.name[language] = boost::to_upper_copy<std::string>(name);
 
-                prep.description = v.second.get(descriptionTag, "");
-                boost::algorithm::trim_right(prep.description);
-                prep.description = boost::to_lower_copy<std::string>(prep.description);
+                    std::string description = v.second.get("Description" + getTagSuffix(language), "");
+                    boost::algorithm::trim_right(description);
+                    prep.description[language] = boost::to_lower_copy<std::string>(description);
+                }
 
                 prep.swissmedNo = v.second.get("SwissmedicNo5", "");
                 if (!prep.swissmedNo.empty())
@@ -116,9 +194,11 @@ void parseXML(const std::string &filename,
                 BOOST_FOREACH(pt::ptree::value_type &p, v.second.get_child("Packs")) {
                     if (p.first == "Pack") {
                         Pack pack;
-                        pack.description = p.second.get(descriptionTag, "");
-                        boost::algorithm::trim_right(pack.description);
-                        pack.description = boost::to_lower_copy<std::string>(pack.description);
+                        for (auto language : languages) {
+                            std::string description = p.second.get("Description" + getTagSuffix(language), "");
+                            boost::algorithm::trim_right(description);
+                            pack.description[language] = boost::to_lower_copy<std::string>(description);
+                        }
 
                         pack.category = p.second.get("SwissmedicCategory", "");
                         pack.gtin = p.second.get("GTIN", "");
@@ -191,13 +271,15 @@ void parseXML(const std::string &filename,
                                 // application_str - choose the one with the longest attribute "Code"
                                 if (maxLen < n) {
                                     maxLen = n;
-                                    itCode.application = itc.second.get(descriptionTag, "");
+                                    for (auto language : languages)
+                                        itCode.application[language] = itc.second.get("Description" + getTagSuffix(language), "");
                                 }
 
                                 // tindex_str - choose the one with the longest attribute "Code"
                                 if (minLen > n) {
                                     minLen = n;
-                                    itCode.tindex = itc.second.get(descriptionTag, "");
+                                    for (auto language : languages)
+                                        itCode.tindex[language] = itc.second.get("Description" + getTagSuffix(language), "");
                                 }
                             }
                         }
@@ -220,6 +302,7 @@ void parseXML(const std::string &filename,
             }
         }
 
+        buildIndexes();
         printFileStats(filename);
     }
     catch (std::exception &e) {
@@ -230,16 +313,19 @@ void parseXML(const std::string &filename,
 // Return count added
 int getAdditionalNames(const std::string &rn,
                        std::set<std::string> &gtinUsed,
-                       GTIN::oneFachinfoPackages &packages)
+                       GTIN::oneFachinfoPackages &packages,
+                       const std::string &language)
 {
     std::set<std::string>::iterator it;
     int countAdded = 0;
 
-    for (Preparation pre : prepList) {
-        if (rn != pre.swissmedNo)
-            continue;
+    auto search = swissmedNoMap.find(rn);
+    if (search == swissmedNoMap.end())
+        return 0;
 
-        for (Pack p : pre.packs) {
+    for (size_t i : search->second) {
+        const Preparation &pre = prepList[i];
+        for (const Pack &p : pre.packs) {
             std::string g13 = p.gtin;
             // Build GTIN if missing
             it = gtinUsed.find(g13);
@@ -251,8 +337,8 @@ int getAdditionalNames(const std::string &rn,
 #ifdef DEBUG_IDENTIFY_NAMES
                 onePackageInfo += "bag+";
 #endif
-                onePackageInfo += pre.name + " " + pre.description;
-                onePackageInfo += ", " + p.description;
+                onePackageInfo += LOC::get(pre.name, language) + " " + LOC::get(pre.description, language);
+                onePackageInfo += ", " + LOC::get(p.description, language);
 
                 std::string paf = getPricesAndFlags(g13, "", p.category);
                 if (!paf.empty())
@@ -261,6 +347,7 @@ int getAdditionalNames(const std::string &rn,
                 gtinUsed.insert(g13);
                 packages.gtin.push_back(g13);
                 packages.name.push_back(onePackageInfo);
+                packages.category.push_back(p.category);
             }
         }
     }
@@ -268,81 +355,56 @@ int getAdditionalNames(const std::string &rn,
     return countAdded;
 }
 
-// Also build a map(gtin) to be used later when writing packages column
+// All the Swiss packs (GTIN 7680...), for productdb
+// Those already in gtinUsed are skipped. Usage stats are not affected
+void getProducts(std::set<std::string> &gtinUsed,
+                 GTIN::products &products,
+                 const std::string &language)
+{
+    for (const Preparation &pre : prepList)
+        for (const Pack &p : pre.packs) {
+            if ((p.gtin.compare(0, 4, "7680") != 0) ||
+                (gtinUsed.find(p.gtin) != gtinUsed.end()))
+                continue;
+
+            std::string name = LOC::get(pre.name, language) + " " + LOC::get(pre.description, language);
+            name += ", " + LOC::get(p.description, language);
+
+            std::string paf = getPricesAndFlags(p.gtin, "", p.category);
+
+            gtinUsed.insert(p.gtin);
+            products.gtin.push_back(p.gtin);
+            products.name.push_back(name);
+            products.packInfo.push_back(name + paf);
+            products.author.push_back("");
+            products.category.push_back(p.category);
+        }
+}
+
 std::string getPricesAndFlags(const std::string &gtin,
                               const std::string &fromSwissmedic,
                               const std::string &category)
 {
-    std::string prices;
-    std::vector<std::string> flagsVector;
-    bool found = false;
-
-    for (Preparation pre : prepList)
-        for (Pack p : pre.packs)
-            if (gtin == p.gtin) {
-                packageFields pf;
-                
-                // Prices
-                if (!p.exFactoryPrice.empty()) {
-                    prices += "EFP " + p.exFactoryPrice;
-                    pf.efp = p.exFactoryPrice;
-                }
-
-                if (!p.publicPrice.empty()) {
-                    prices += ", PP " + p.publicPrice;
-                    pf.pp = p.publicPrice;
-                }
-
-                if (!p.exFactoryPriceValidFrom.empty()) { // for pharma.csv
-                    pf.efp_validFrom = p.exFactoryPriceValidFrom;
-                }
-
-                // Flags
-                if (!category.empty())
-                    flagsVector.push_back(category);
-
-                if (!p.exFactoryPrice.empty() || !p.publicPrice.empty())
-                    flagsVector.push_back("SL");  // TODO: localize to LS for French
-
-                if (!p.limitationPoints.empty())
-                    flagsVector.push_back("LIM" + p.limitationPoints);
-
-                // SB: Selbstbehalt
-                if (pre.sb20 == "Y")
-                    flagsVector.push_back("SB 20%");
-                else if (pre.sb20 == "N")
-                    flagsVector.push_back("SB 10%");
+    std::string paf;
 
-                if (!pre.orgen.empty())
-                    flagsVector.push_back(pre.orgen);
+    // The category (input parameter) must be added even if the GTIN was not found
+    std::string flags = category;
 
-                pf.flags = flagsVector;
-                packMap[gtin] = pf;
-                found = true;
-                goto prepareResult; // abort the two for loops
-            }
+    auto search = packPricesMap.find(gtin);
+    if (search != packPricesMap.end()) {
+        const PackPrices &pp = search->second;
+        if (!pp.prices.empty())
+            paf += ", " + pp.prices;
 
-prepareResult:
-    // The category (input parameter) must be added even if the GTIN was not found
-    if (!found) {
-        if (!category.empty())
-            flagsVector.push_back(category);
-
-//        std::clog
-//        << basename((char *)__FILE__) << ":" << __LINE__
-//        << ", NOT FOUND: " << gtin
-//        << std::endl;
+        if (!pp.flags.empty())
+            flags += (flags.empty() ? "" : ", ") + pp.flags;
     }
-    
-    std::string paf;
-    if (!prices.empty())
-        paf += ", " + prices;
-    
+
     if (!fromSwissmedic.empty())
         paf += ", " + fromSwissmedic;
 
-    if (flagsVector.size() > 0)
-        paf += " [" + boost::algorithm::join(flagsVector, ", ") + "]";
+    if (!flags.empty())
+        paf += " [" + flags + "]";
 
     return paf;
 }
@@ -351,36 +413,32 @@ std::vector<std::string> getGtinList()
 {
     std::vector<std::string> list;
 
-    for (Preparation pre : prepList)
-        for (Pack p : pre.packs)
+    for (const Preparation &pre : prepList)
+        for (const Pack &p : pre.packs)
             if (!p.gtin.empty())
                 list.push_back(p.gtin);
 
     return list;
 }
 
-std::string getTindex(const std::string &rn)
+std::string getTindex(const std::string &rn,
+                      const std::string &language)
 {
     std::string tindex;
-    for (Preparation pre : prepList) {
-        if (rn == pre.swissmedNo) {
-            tindex = pre.itCodes.tindex;
-            break;
-        }
-    }
+    auto search = swissmedNoMap.find(rn);
+    if (search != swissmedNoMap.end())
+        tindex = LOC::get(prepList[search->second.front()].itCodes.tindex, language);
 
     return tindex;
 }
     
-std::string getApplication(const std::string &rn)
+std::string getApplication(const std::string &rn,
+                           const std::string &language)
 {
     std::string app;
-    for (Preparation p : prepList) {
-        if (rn == p.swissmedNo) {
-            app = p.itCodes.application + " (BAG)";
-            break;
-        }
-    }
+    auto search = swissmedNoMap.find(rn);
+    if (search != swissmedNoMap.end())
+        app = LOC::get(prepList[search->second.front()].itCodes.application, language) + " (BAG)";
 
     return app;
 }
@@ -397,9 +455,19 @@ std::string formatPriceAsMoney(const std::string &price)
     return s.str();
 }
 
-packageFields getPackageFieldsByGtin(const std::string &gtin)
+// The flags start with the category, as in getPricesAndFlags()
+packageFields getPackageFieldsByGtin(const std::string &gtin,
+                                     const std::string &category)
 {
-    return packMap[gtin];
+    auto search = packPricesMap.find(gtin);
+    if (search == packPricesMap.end())
+        return {};
+
+    packageFields pf = search->second.fields;
+    if (!category.empty())
+        pf.flags.insert(pf.flags.begin(), category);
+
+    return pf;
 }
 
 }
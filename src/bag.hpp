@@ -13,6 +13,7 @@
 #include <iostream>
 #include <map>
 #include "gtin.hpp"
+#include "localized.hpp"
 
 namespace BAG
 {
@@ -25,12 +26,12 @@ namespace BAG
     };
 
     struct ItCode {
-        std::string tindex;         // localized
-        std::string application;    // localized
+        LOC::Text tindex;
+        LOC::Text application;
     };
 
     struct Pack {
-        std::string description;
+        LOC::Text description;
         std::string category;
         std::string gtin;
         std::string exFactoryPrice;
@@ -40,8 +41,8 @@ namespace BAG
     };
 
     struct Preparation {
-        std::string name;
-        std::string description;
+        LOC::Text name;
+        LOC::Text description;
         std::string swissmedNo;     // same as regnr
         std::string orgen;
         std::string sb20;
@@ -50,27 +51,34 @@ namespace BAG
     };
     
     typedef std::vector<Preparation> PreparationList;
-    typedef std::map<std::string, packageFields> PackageMap;
 
     void parseXML(const std::string &filename,
-                  const std::string &language,
+                  const std::vector<std::string> &languages,
                   bool verbose);
 
     int getAdditionalNames(const std::string &rn,
                            std::set<std::string> &gtinUsed,
-                           GTIN::oneFachinfoPackages &packages);
+                           GTIN::oneFachinfoPackages &packages,
+                           const std::string &language);
+
+    void getProducts(std::set<std::string> &gtinUsed,
+                     GTIN::products &products,
+                     const std::string &language);
 
     std::string getPricesAndFlags(const std::string &gtin,
                                   const std::string &fromSwissmedic,
                                   const std::string &category="");
 
     std::vector<std::string> getGtinList();
-    std::string getTindex(const std::string &rn);
-    std::string getApplication(const std::string &rn);
+    std::string getTindex(const std::string &rn,
+                          const std::string &language);
+    std::string getApplication(const std::string &rn,
+                               const std::string &language);
     
     std::string formatPriceAsMoney(const std::string &price);
 
-    packageFields getPackageFieldsByGtin(const std::string &gtin);
+    packageFields getPackageFieldsByGtin(const std::string &gtin,
+                                         const std::string &category);
 
     void printUsageStats();
 }
@@ -48,7 +48,8 @@ void sort(GTIN::oneFachinfoPackages &packages)
     // For a couple of packages: 26395 SOLCOSERYL, and 37397 VENTOLIN
     // we have more pack info lines than gtins, because there are some
     // doubles pack info lines
-    if (packages.name.size() != packages.gtin.size()) {
+    if ((packages.name.size() != packages.gtin.size()) ||
+        (packages.category.size() != packages.gtin.size())) {
         std::cerr << std::endl
         << basename((char *)__FILE__) << ":" << __LINE__
         << ", ERROR - pack info lines: " << packages.name.size()
@@ -76,19 +77,27 @@ void sort(GTIN::oneFachinfoPackages &packages)
     std::vector<std::string> gtinsWithoutPrice;
     std::vector<std::string>::iterator itGtin;
 
+    std::vector<std::string> categoriesWithPrice;
+    std::vector<std::string> categoriesWithoutPrice;
+    std::vector<std::string>::iterator itCategory;
+
     itGtin = packages.gtin.begin();
+    itCategory = packages.category.begin();
     for (auto line : packages.name)
     {
         if (std::regex_search(line, r)) {
             linesWithPrice.push_back(line);
             gtinsWithPrice.push_back(*itGtin);
+            categoriesWithPrice.push_back(*itCategory);
         }
         else {
             linesWithoutPrice.push_back(line);
             gtinsWithoutPrice.push_back(*itGtin);
+            categoriesWithoutPrice.push_back(*itCategory);
         }
         
         itGtin++;
+        itCategory++;
     }
     
     // TODO: sort by galenic form each of the two vectors
@@ -96,19 +105,24 @@ void sort(GTIN::oneFachinfoPackages &packages)
     // Prepare the results
     packages.name.clear();
     packages.gtin.clear();
+    packages.category.clear();
 
     //std::string s;
 
     itGtin = gtinsWithPrice.begin();
+    itCategory = categoriesWithPrice.begin();
     for (auto l : linesWithPrice) {
         packages.name.push_back(l);
         packages.gtin.push_back(*itGtin++);
+        packages.category.push_back(*itCategory++);
     }
 
     itGtin = gtinsWithoutPrice.begin();
+    itCategory = categoriesWithoutPrice.begin();
     for (auto l : linesWithoutPrice) {
         packages.name.push_back(l);
         packages.gtin.push_back(*itGtin++);
+        packages.category.push_back(*itCategory++);
     }
 }
     
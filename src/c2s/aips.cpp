@@ -8,9 +8,14 @@
 //
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <set>
 #include <map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
 #include <libgen.h>     // for basename()
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -23,21 +28,21 @@
 #include "swissmedic.hpp"
 #include "peddose.hpp"
 #include "report.hpp"
+#include "parallel.hpp"
 
 namespace pt = boost::property_tree;
 
 namespace AIPS
 {
-    MedicineList medList;
-
     // Parse-phase stats
-    unsigned int statsAtcFromEphaCount = 0;
-    unsigned int statsAtcFromAipsCount = 0;
-    unsigned int statsAtcFromSwissmedicCount = 0;
+    std::map<std::string, unsigned int> statsMedicineCountMap; // key is language
+    std::atomic<unsigned int> statsAtcFromEphaCount{0};
+    std::atomic<unsigned int> statsAtcFromAipsCount{0};
+    std::atomic<unsigned int> statsAtcFromSwissmedicCount{0};
 
-    unsigned int statsAtcTextFoundCount = 0;
-    unsigned int statsPedTextFoundCount = 0;
-    unsigned int statsAtcTextNotFoundCount = 0;
+    std::atomic<unsigned int> statsAtcTextFoundCount{0};
+    std::atomic<unsigned int> statsPedTextFoundCount{0};
+    std::atomic<unsigned int> statsAtcTextNotFoundCount{0};
     std::vector<std::string> statsTitlesWithRnZeroVec;
     std::set<std::string> statsUniqueAtcSet; // Issue #70
 
@@ -45,28 +50,38 @@ namespace AIPS
     std::vector<std::string> statsDuplicateRegnrsVec;
     std::set<std::string> statsMissingImgAltSet;
     std::vector<std::string> statsTitlesWithInvalidATCVec;
+    std::mutex statsMutex;
 
 void addStatsMissingAlt(const std::string &regnrs, const int sectionNumber)
 {
     // TODO: add the section number to a set
+    std::lock_guard<std::mutex> lock(statsMutex);
     statsMissingImgAltSet.insert(regnrs);
 }
 
 void addStatsInvalidAtc(const std::string &title, const std::string &rns)
 {
+    std::lock_guard<std::mutex> lock(statsMutex);
     statsTitlesWithInvalidATCVec.push_back("RN: <" + rns + "> " + ", title: <" + title + "> ");
 }
     
 static
 void printFileStats(const std::string &filename,
-                    const std::string &language,
+                    const std::vector<std::string> &languages,
                     const std::string &type)
 {
+    // Filled by several threads, sort them so that the report is the same every time
+    std::sort(statsTitlesWithRnZeroVec.begin(), statsTitlesWithRnZeroVec.end());
+    std::sort(statsDuplicateRegnrsVec.begin(), statsDuplicateRegnrsVec.end());
+    std::sort(statsTitlesWithInvalidATCVec.begin(), statsTitlesWithInvalidATCVec.end());
+
     REP::html_h2("AIPS");
     REP::html_p(filename);
     
     REP::html_start_ul();
-    REP::html_li("medicalInformation " + type + " " + language + " " + std::to_string(medList.size()));
+    for (auto language : languages)
+        REP::html_li("medicalInformation " + type + " " + language + " " + std::to_string(statsMedicineCountMap[language]));
+
     REP::html_end_ul();
     
     REP::html_h3("ATC codes " + std::to_string(statsAtcFromEphaCount + statsAtcFromAipsCount + statsAtcFromSwissmedicCount + statsTitlesWithInvalidATCVec.size()));
@@ -124,171 +139,379 @@ void printUsageStats()
     }
 }
 
-MedicineList & parseXML(const std::string &filename,
-                        const std::string &language,
+// Fill Med and language from one <medicalInformation> element
+// Returns false if it's not for one of the given languages and the type
+static bool getMedicine(pt::ptree &mi,
+                        const std::vector<std::string> &languages,
                         const std::string &type,
-                        bool verbose)
+                        bool verbose,
+                        Medicine &Med,
+                        std::string &language)
 {
-    pt::ptree tree;
-    
-    try {
-        std::clog << std::endl << "Reading AIPS XML" << std::endl;
-        pt::read_xml(filename, tree);
+    std::string typ;
+    std::string lan;
+    pt::ptree & attributes = mi.get_child("<xmlattr>");
+    BOOST_FOREACH(pt::ptree::value_type &att, attributes) {
+        //std::cerr << "attr 1st: " << att.first.data() << ", 2nd: " << att.second.data() << std::endl;
+        if (att.first == "type") {
+            typ = att.second.data();
+            //std::cerr << "Line: " << __LINE__ << ", type: " << type << std::endl;
+        }
+
+        if (att.first == "lang") {
+            lan = att.second.data();
+            //std::cerr << "Line: " << __LINE__ << ", language: " << language << std::endl;
+        }
     }
-    catch (std::exception &e) {
-        std::cerr << "Line: " << __LINE__ << " Error " << e.what() << std::endl;
+
+    if ((typ != type) ||
+        (std::find(languages.begin(), languages.end(), lan) == languages.end()))
+    {
+        return false;
     }
-    
-    std::clog << "Analyzing AIPS" << std::endl;
 
-    try {
-        BOOST_FOREACH(pt::ptree::value_type &v, tree.get_child("medicalInformations")) {
-            
-            if (v.first == "medicalInformation") {
-                
-                std::string typ;
-                std::string lan;
-                pt::ptree & attributes = v.second.get_child("<xmlattr>");
-                BOOST_FOREACH(pt::ptree::value_type &att, attributes) {
-                    //std::cerr << "attr 1st: " << att.first.data() << ", 2nd: " << att.second.data() << std::endl;
-                    if (att.first == "type") {
-                        typ = att.second.data();
-                        //std::cerr << "Line: " << __LINE__ << ", type: " << type << std::endl;
-                    }
-
-                    if (att.first == "lang") {
-                        lan = att.second.data();
-                        //std::cerr << "Line: " << __LINE__ << ", language: " << language << std::endl;
-                    }
-                }
+    language = lan;
+
+    Med.title = mi.get("title", "");
+    boost::replace_all(Med.title, "&#038;", "&"); // Issue #49
+
+    Med.auth = mi.get("authHolder", "");
+
+    Med.subst = mi.get("substances", "");
 
-                if ((lan == language) && (typ == type)) {
-                    Medicine Med;
-                    Med.title = v.second.get("title", "");
-                    boost::replace_all(Med.title, "&#038;", "&"); // Issue #49
-                    
-                    Med.auth = v.second.get("authHolder", "");
-                    
-                    Med.subst = v.second.get("substances", "");
-
-                    std::vector<std::string> rnVector;
-                    {
-                        Med.regnrs = v.second.get("authNrs", "");
-                        boost::algorithm::split(rnVector, Med.regnrs, boost::is_any_of(", "), boost::token_compress_on);
-                        
-                        if (rnVector[0] == "00000")
-                            statsTitlesWithRnZeroVec.push_back(Med.title);
+    std::vector<std::string> rnVector;
+    {
+        Med.regnrs = mi.get("authNrs", "");
+        boost::algorithm::split(rnVector, Med.regnrs, boost::is_any_of(", "), boost::token_compress_on);
+
+        if (rnVector[0] == "00000") {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            statsTitlesWithRnZeroVec.push_back(Med.title);
+        }
 #ifdef DEBUG
-                        // Check that there are no non-numeric characters
-                        // See HTML for rn 51908 ("Numéro d’autorisation 51'908")
-                        if (Med.regnrs.find_first_not_of("0123456789, ") != std::string::npos)
-                            std::clog
-                            << basename((char *)__FILE__) << ":" << __LINE__
-                            << ", rn: <" << Med.regnrs + ">"
-                            << ", title: <" << Med.title + ">"
-                            << std::endl;
+        // Check that there are no non-numeric characters
+        // See HTML for rn 51908 ("Numéro d’autorisation 51'908")
+        if (Med.regnrs.find_first_not_of("0123456789, ") != std::string::npos)
+            std::clog
+            << basename((char *)__FILE__) << ":" << __LINE__
+            << ", rn: <" << Med.regnrs + ">"
+            << ", title: <" << Med.title + ">"
+            << std::endl;
 #endif
 
-                        int sizeBefore = rnVector.size();
-                        if (sizeBefore > 1) {
-                            // Make sure there are no duplicate rn (26395 SOLCOSERYL, 37397 VENTOLIN)
-                            // Preferable not to sort, which would affect the default order of packages later on
-                            // Skip sorting assuming duplicate elements are guaranteed to be consecutive
-                            // std::sort( rnVector.begin(), rnVector.end() );
-                            rnVector.erase( std::unique( rnVector.begin(), rnVector.end()), rnVector.end());
-
-                            Med.regnrs = boost::algorithm::join(rnVector, ",");
-                            int sizeAfter = rnVector.size();
-                            if (sizeBefore != sizeAfter)
-                                statsDuplicateRegnrsVec.push_back(Med.regnrs);
-                        }
-                    }
-                    
+        int sizeBefore = rnVector.size();
+        if (sizeBefore > 1) {
+            // Make sure there are no duplicate rn (26395 SOLCOSERYL, 37397 VENTOLIN)
+            // Preferable not to sort, which would affect the default order of packages later on
+            // Skip sorting assuming duplicate elements are guaranteed to be consecutive
+            // std::sort( rnVector.begin(), rnVector.end() );
+            rnVector.erase( std::unique( rnVector.begin(), rnVector.end()), rnVector.end());
+
+            Med.regnrs = boost::algorithm::join(rnVector, ",");
+            int sizeAfter = rnVector.size();
+            if (sizeBefore != sizeAfter) {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                statsDuplicateRegnrsVec.push_back(Med.regnrs);
+            }
+        }
+    }
+
 #if 0
-                    Med.atc = EPHA::getAtcFromSingleRn(rnVector[0]);
-                    if (!Med.atc.empty()) {
-                        statsAtcFromEphaCount++;
-                    }
-                    else
+    Med.atc = EPHA::getAtcFromSingleRn(rnVector[0]);
+    if (!Med.atc.empty()) {
+        statsAtcFromEphaCount++;
+    }
+    else
 #endif
-                    {
-                        // Fallback 1
-                        Med.atc = v.second.get("atcCode", ""); // These ATCs need to be cleaned up
-                        ATC::validate(Med.regnrs, Med.atc);    // Clean up the ATCs
-                        if (!Med.atc.empty()) {
-                            statsAtcFromAipsCount++;
-                        }
-                        else {
-                            // Fallback 2
-                            Med.atc = SWISSMEDIC::getAtcFromFirstRn(rnVector[0]);
-                            if (!Med.atc.empty()) {
-                                statsAtcFromSwissmedicCount++;
-                            }
-                            else {
-                                // Add it to the report
-                                AIPS::addStatsInvalidAtc(Med.title, Med.regnrs);
-                            }
-                        }
-                    }
-                    
-                    // Add ";" and localized text from 'atc_codes_multi_lingual.txt'
-                    if (!Med.atc.empty()) {
+    {
+        // Fallback 1
+        Med.atc = mi.get("atcCode", ""); // These ATCs need to be cleaned up
+        ATC::validate(Med.regnrs, Med.atc);    // Clean up the ATCs
+        if (!Med.atc.empty()) {
+            statsAtcFromAipsCount++;
+        }
+        else {
+            // Fallback 2
+            Med.atc = SWISSMEDIC::getAtcFromFirstRn(rnVector[0]);
+            if (!Med.atc.empty()) {
+                statsAtcFromSwissmedicCount++;
+            }
+            else {
+                // Add it to the report
+                AIPS::addStatsInvalidAtc(Med.title, Med.regnrs);
+            }
+        }
+    }
+
+    // Add ";" and localized text from 'atc_codes_multi_lingual.txt'
+    if (!Med.atc.empty()) {
 #if 1 // Issue #70
-                        if (boost::contains(Med.atc, ",")) {
-                            std::vector<std::string> atcVector;
-                            boost::algorithm::split(atcVector, Med.atc, boost::is_any_of(","));
-                            for (auto a : atcVector)
-                                statsUniqueAtcSet.insert(a);
-                        }
-                        else {
-                            statsUniqueAtcSet.insert(Med.atc);
-                        }
+        std::unique_lock<std::mutex> lock(statsMutex);
+        if (boost::contains(Med.atc, ",")) {
+            std::vector<std::string> atcVector;
+            boost::algorithm::split(atcVector, Med.atc, boost::is_any_of(","));
+            for (auto a : atcVector)
+                statsUniqueAtcSet.insert(a);
+        }
+        else {
+            statsUniqueAtcSet.insert(Med.atc);
+        }
+        lock.unlock();
 #endif
-                        std::string atcText = ATC::getTextByAtcs(Med.atc);
-                        if (!atcText.empty()) {
-                            statsAtcTextFoundCount++;
-                            Med.atc += ";" + atcText;
-                        }
-                        else {
-                            // Fallback 1
-                            atcText = PED::getTextByAtcs(Med.atc);
-                            if (!atcText.empty()) {
-                                statsPedTextFoundCount++;
-                                Med.atc += ";" + atcText;
-                            }
-                            else {
-                                statsAtcTextNotFoundCount++;
-                                if (verbose) {
-                                    std::clog
-                                    << "[" << statsAtcTextNotFoundCount << "]"
-                                    << " no text for ATC: <" << Med.atc << ">"
-                                    << " (first rn: " << rnVector[0] << ")"
-                                    << std::endl;
-                                }
-                            }
-                        }
-                    }
-                    
-                    //std::cerr << "remark: " << v.second.get("remark", "") << std::endl;
-                    //std::cerr << "style: " << v.second.get("style", "") << std::endl; // unused
-
-                    Med.content = v.second.get("content", "");
-                    //std::cout << "Med.content: " << Med.content << std::endl;
-
-                    //std::cerr << "title: " << Med.title << ", atc: " << Med.atc << ", subst: " << Med.subst << std::endl;
-
-                    medList.push_back(Med);
+        std::string atcText = ATC::getTextByAtcs(Med.atc, language);
+        if (!atcText.empty()) {
+            statsAtcTextFoundCount++;
+            Med.atc += ";" + atcText;
+        }
+        else {
+            // Fallback 1
+            atcText = PED::getTextByAtcs(Med.atc, language);
+            if (!atcText.empty()) {
+                statsPedTextFoundCount++;
+                Med.atc += ";" + atcText;
+            }
+            else {
+                unsigned int n = ++statsAtcTextNotFoundCount;
+                if (verbose) {
+                    std::clog
+                    << "[" << n << "]"
+                    << " no text for ATC: <" << Med.atc << ">"
+                    << " (first rn: " << rnVector[0] << ")"
+                    << std::endl;
                 }
             }
         }
+    }
+
+    //std::cerr << "remark: " << mi.get("remark", "") << std::endl;
+    //std::cerr << "style: " << mi.get("style", "") << std::endl; // unused
+
+    Med.content = mi.get("content", "");
+    //std::cout << "Med.content: " << Med.content << std::endl;
+
+    //std::cerr << "title: " << Med.title << ", atc: " << Med.atc << ", subst: " << Med.subst << std::endl;
+
+    return true;
+}
+
+// The file is read in blocks of this size
+#define AIPS_READ_BLOCK_SIZE    (1024 * 1024)
+
+// <medicalInformation> elements given to a parsing thread at a time
+#define AIPS_CHUNK_SIZE         16
+
+// One <medicalInformation> of the languages and type being parsed
+struct ParsedMedicine {
+    std::string language;
+    Medicine medicine;
+};
+
+// Elements of the file, numbered in file order
+struct AipsChunk {
+    size_t seq = 0;
+    std::vector<std::string> elements;
+};
+
+// Value of an attribute of the start tag, or empty if not found
+static std::string getStartTagAttribute(const std::string &xml,
+                                        const std::string &name)
+{
+    std::string::size_type tagEnd = xml.find('>');
+    std::string::size_type pos = xml.find(" " + name + "=");
+    if ((pos == std::string::npos) || (pos > tagEnd))
+        return {};
+
+    pos += name.size() + 2;
+    if (pos >= tagEnd)
+        return {};
+
+    char quote = xml[pos];
+    std::string::size_type valueEnd = xml.find(quote, pos + 1);
+    if (valueEnd == std::string::npos)
+        return {};
+
+    return xml.substr(pos + 1, valueEnd - pos - 1);
+}
+
+// Read the file and call onElement() with each <medicalInformation> element, in order
+// Returns the number of elements
+static unsigned int splitElements(std::ifstream &ifs,
+                                  std::function<void(std::string &&)> onElement)
+{
+    // Only one <medicalInformation> element at a time is given to the XML parser,
+    // so that the first ones can be used while the rest of the file is being read
+    const std::string startTag("<medicalInformation");
+    const std::string endTag("</medicalInformation>");
+    std::string buffer;
+    std::vector<char> block(AIPS_READ_BLOCK_SIZE);
+    unsigned int count = 0;
+    bool eof = false;
+    while (!eof) {
+        ifs.read(block.data(), block.size());
+        buffer.append(block.data(), ifs.gcount());
+        eof = !ifs;
+
+        std::string::size_type pos = 0;
+        for (;;) {
+            // Skip "<medicalInformations"
+            std::string::size_type start = buffer.find(startTag, pos);
+            while ((start != std::string::npos) &&
+                   (start + startTag.size() < buffer.size()) &&
+                   (buffer[start + startTag.size()] == 's'))
+            {
+                start = buffer.find(startTag, start + startTag.size());
+            }
+
+            if (start == std::string::npos) {
+                // Keep what could be the beginning of a start tag
+                pos = (buffer.size() > startTag.size()) ? buffer.size() - startTag.size() : 0;
+                break;
+            }
+
+            std::string::size_type end = buffer.find(endTag, start);
+            if (end == std::string::npos) {
+                pos = start;
+                break;
+            }
+
+            end += endTag.size();
+            pos = end;
+
+            count++;
+            onElement(buffer.substr(start, end - start));
+        }
+
+        buffer.erase(0, pos);
+    }
 
-        printFileStats(filename, language, type);
+    return count;
+}
+
+// Append to parsed the Medicine of one <medicalInformation> element,
+// if it's for one of the languages and the type
+static void parseElement(const std::string &xml,
+                         const std::vector<std::string> &languages,
+                         const std::string &type,
+                         bool verbose,
+                         std::vector<ParsedMedicine> &parsed)
+{
+    // Most elements are for another language or type, skip them
+    // without building the tree if the start tag tells so
+    std::string typ = getStartTagAttribute(xml, "type");
+    std::string lan = getStartTagAttribute(xml, "lang");
+    if ((!typ.empty() && (typ != type)) ||
+        (!lan.empty() && (std::find(languages.begin(), languages.end(), lan) == languages.end())))
+    {
+        return;
+    }
+
+    pt::ptree tree;
+    try {
+        std::istringstream iss(xml);
+        pt::read_xml(iss, tree);
     }
     catch (std::exception &e) {
         std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error " << e.what() << std::endl;
+        return;
     }
-    
-    return medList;
+
+    ParsedMedicine pm;
+    try {
+        if (!getMedicine(tree.get_child("medicalInformation"), languages, type, verbose, pm.medicine, pm.language))
+            return;
+    }
+    catch (std::exception &e) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error " << e.what() << std::endl;
+        return;
+    }
+
+    parsed.push_back(std::move(pm));
+}
+
+void parseXML(const std::string &filename,
+              const std::vector<std::string> &languages,
+              const std::string &type,
+              bool verbose,
+              unsigned int jobs,
+              std::function<void(const std::string &language, Medicine &&)> onMedicine)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error opening " << filename << std::endl;
+        return;
+    }
+
+    std::clog << std::endl << "Reading AIPS XML" << std::endl;
+
+    auto deliver = [&](std::vector<ParsedMedicine> &parsed) {
+        for (auto &pm : parsed) {
+            statsMedicineCountMap[pm.language]++;
+            onMedicine(pm.language, std::move(pm.medicine));
+        }
+    };
+
+    unsigned int count = 0;
+    if (jobs <= 1) {
+        count = splitElements(ifs, [&](std::string &&xml) {
+            std::vector<ParsedMedicine> parsed;
+            parseElement(xml, languages, type, verbose, parsed);
+            deliver(parsed);
+        });
+    }
+    else {
+        // This thread reads the file and cuts it into chunks of elements,
+        // 'jobs' threads parse the chunks, and the Medicines are passed on
+        // by this thread in file order
+        PAR::BoundedQueue<AipsChunk> chunkQueue(2 * jobs);
+        PAR::ReorderQueue<std::vector<ParsedMedicine>> parsedQueue(2 * jobs);
+
+        std::vector<std::thread> threads;
+        std::atomic<unsigned int> threadsLeft{jobs};
+        for (unsigned int t = 0; t < jobs; t++) {
+            threads.emplace_back([&] {
+                while (std::optional<AipsChunk> chunk = chunkQueue.pop()) {
+                    std::vector<ParsedMedicine> parsed;
+                    for (auto &xml : chunk->elements)
+                        parseElement(xml, languages, type, verbose, parsed);
+
+                    parsedQueue.push(chunk->seq, std::move(parsed));
+                }
+
+                if (--threadsLeft == 0)
+                    parsedQueue.close();
+            });
+        }
+
+        threads.emplace_back([&] {
+            AipsChunk chunk;
+            count = splitElements(ifs, [&](std::string &&xml) {
+                chunk.elements.push_back(std::move(xml));
+                if (chunk.elements.size() < AIPS_CHUNK_SIZE)
+                    return;
+
+                size_t seq = chunk.seq;
+                chunkQueue.push(std::move(chunk));
+                chunk = AipsChunk();
+                chunk.seq = seq + 1;
+            });
+
+            if (!chunk.elements.empty())
+                chunkQueue.push(std::move(chunk));
+
+            chunkQueue.close();
+        });
+
+        while (std::optional<std::vector<ParsedMedicine>> parsed = parsedQueue.pop())
+            deliver(*parsed);
+
+        for (auto &t : threads)
+            t.join();
+    }
+
+    if (count == 0)
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error no medicalInformation in " << filename << std::endl;
+
+    printFileStats(filename, languages, type);
 }
 
 }
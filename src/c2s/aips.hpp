@@ -10,14 +10,24 @@
 #ifndef aips_hpp
 #define aips_hpp
 
+#include <string>
+#include <vector>
+#include <functional>
 #include "medicine.h"
 
 namespace AIPS
 {
-    MedicineList & parseXML(const std::string &filename,
-                            const std::string &language,
-                            const std::string &type,
-                            bool verbose);
+    // Each Medicine is passed on, without keeping a list of them,
+    // as soon as its <medicalInformation> has been read, together with
+    // its language, so that the file is read once for all the languages
+    // The elements are parsed on 'jobs' threads and passed on in file order
+    void parseXML(const std::string &filename,
+                  const std::vector<std::string> &languages,
+                  const std::string &type,
+                  bool verbose,
+                  unsigned int jobs,
+                  std::function<void(const std::string &language, Medicine &&)> onMedicine);
+
     void addStatsMissingAlt(const std::string &regnrs,
                             const int sectionNumber);
     void addStatsInvalidAtc(const std::string &title,
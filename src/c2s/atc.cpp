@@ -14,6 +14,7 @@
 #include <libgen.h>     // for basename()
 #include <regex>
 #include <map>
+#include <mutex>
 
 #include <boost/algorithm/string.hpp>
 //#include <boost/locale.hpp>
@@ -22,12 +23,14 @@
 #include "atc.hpp"
 #include "swissmedic.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 namespace ATC
 {
-    std::map<std::string, std::string> atcMap;
+    std::map<std::string, LOC::Text> atcMap;
     std::string statsFilename;
     std::set<std::string> atcMissingSet;
+    std::mutex atcMissingMutex;
 
 static
 void printFileStats(const std::string &filename)
@@ -53,13 +56,14 @@ void printUsageStats()
 }
     
 void parseTXT(const std::string &filename,
-              const std::string &language,
+              const std::vector<std::string> &languages,
               bool verbose)
 {
     statsFilename = filename;
     try {
         std::clog << std::endl << "Reading atc TXT" << std::endl;
-        std::ifstream file(filename);
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream file(*buffer);
 
         std::string str;
         while (std::getline(file, str)) {
@@ -75,8 +79,11 @@ void parseTXT(const std::string &filename,
 
             auto textFr = str.substr(pos2+separator2.length()); // pos, len
 
-            atcMap.insert(std::make_pair(atc,
-                                         language == "fr" ? textFr : textDe));
+            LOC::Text text;
+            for (auto language : languages)
+                text[language] = (language == "fr") ? textFr : textDe;
+
+            atcMap.insert(std::make_pair(atc, text));
         }
     }
     catch (std::exception &e) {
@@ -126,36 +133,39 @@ void validate(const std::string &regnrs, std::string &atc)
 }
 
 // The input string is a single atc
-std::string getTextByAtc(const std::string atc)
+std::string getTextByAtc(const std::string atc,
+                         const std::string &language)
 {
     std::string text;
     auto search = atcMap.find(atc);
     if (search != atcMap.end())
-        text = search->second;
+        text = LOC::get(search->second, language);
     
     return text;
 }
 
 // The input string is in the format "atccode[,atccode]*"
-std::string getTextByAtcs(const std::string atcs)
+std::string getTextByAtcs(const std::string atcs,
+                          const std::string &language)
 {
     std::string text;
     std::string firstAtc = getFirstAtc(atcs);
 
-    return getTextByAtc(firstAtc);
+    return getTextByAtc(firstAtc, language);
 }
     
 static
-std::string getTextByAtc(const std::string atc, const int n)
+std::string getTextByAtc(const std::string atc, const int n, const std::string &language)
 {
     std::string s;
 
     if (atc.length() > n) {
         std::string sub = atc.substr(0,n);
-        s = getTextByAtc(sub);
+        s = getTextByAtc(sub, language);
 
         if (s.empty()) {
             // Report missing
+            std::lock_guard<std::mutex> lock(atcMissingMutex);
             std::set<std::string>::iterator it;
             it = atcMissingSet.find(sub);
             if (it == atcMissingSet.end()) { // Report it only once by using a set
@@ -181,14 +191,15 @@ std::string getTextByAtc(const std::string atc, const int n)
 }
 
 // The input string is in the format "atccode[,atccode]*;text"
-std::string getClassByAtcColumn(const std::string atcColumn)
+std::string getClassByAtcColumn(const std::string atcColumn,
+                                const std::string &language)
 {
     auto atc = getFirstAtcInAtcColumn(atcColumn);
 
-    std::string s1 = getTextByAtc(atc, 1);
-    std::string s3 = getTextByAtc(atc, 3);
-    std::string s4 = getTextByAtc(atc, 4);
-    std::string s5 = getTextByAtc(atc, 5);
+    std::string s1 = getTextByAtc(atc, 1, language);
+    std::string s3 = getTextByAtc(atc, 3, language);
+    std::string s4 = getTextByAtc(atc, 4, language);
+    std::string s5 = getTextByAtc(atc, 5, language);
 
     return s1 + ";" + s3 + ";" + s4 + "#" + s5 + "#";
 }
@@ -10,18 +10,23 @@
 #ifndef atc_hpp
 #define atc_hpp
 
+#include "localized.hpp"
+
 namespace ATC
 {
     void parseTXT(const std::string &filename,
-                  const std::string &language,
+                  const std::vector<std::string> &languages,
                   bool verbose);
 
     void validate(const std::string &regnrs,
                   std::string &name);
     
-    std::string getTextByAtc(const std::string atc);
-    std::string getTextByAtcs(const std::string atcs);
-    std::string getClassByAtcColumn(const std::string atcColumn);
+    std::string getTextByAtc(const std::string atc,
+                             const std::string &language);
+    std::string getTextByAtcs(const std::string atcs,
+                              const std::string &language);
+    std::string getClassByAtcColumn(const std::string atcColumn,
+                                    const std::string &language);
     std::string getFirstAtcInAtcColumn(const std::string atcColumn);
     std::string getFirstAtc(const std::string atc);
 
@@ -17,6 +17,10 @@
 //#include <clocale>
 #include <algorithm>
 #include <ctime>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <optional>
 
 #include <sqlite3.h>
 #include <libgen.h>     // for basename()
@@ -44,6 +48,10 @@
 #include "gtin.hpp"
 #include "peddose.hpp"
 #include "report.hpp"
+#include "parallel.hpp"
+#include "localized.hpp"
+#include "loader.hpp"
+#include "zip.hpp"
 #include "config.h"
 
 #include "ean13/functii.h"
@@ -62,6 +70,13 @@
 
 #define TITLES_STR_SEPARATOR    ";"
 
+// Capacity of the queues between the stages of the pipeline
+#define PIPELINE_QUEUE_SIZE     32
+
+// Increase it when the HTML is rendered differently,
+// so that an incremental run renders all the rows again
+#define RENDER_FORMAT_VERSION   "1"
+
 // Additional sections, not in the XML
 // If you change these numbers also update smartinfo.py near line 74
 // Note: AmiKo (macOS) expects
@@ -76,8 +91,9 @@ namespace pt = boost::property_tree;
 
 static std::string appName;
 std::map<std::string, std::string> statsTitleStrSeparatorMap;
+std::mutex statsMutex;
 #ifdef SAPPINFO_OLD_STATS
-unsigned int statsSappinfoSectionsCreated = 0;  // Issue #70
+std::atomic<unsigned int> statsSappinfoSectionsCreated{0};  // Issue #70
 #endif
 
 void on_version()
@@ -90,15 +106,13 @@ void on_version()
     std::cout << "BOOST_VERSION: " << BOOST_LIB_VERSION << std::endl;
 }
 
-int countAipsPackagesInSwissmedic(AIPS::MedicineList &list)
+int countAipsPackagesInSwissmedic(const AIPS::Medicine &m)
 {
     int count = 0;
-    for (AIPS::Medicine m : list) {
-        std::vector<std::string> regnrs;
-        boost::algorithm::split(regnrs, m.regnrs, boost::is_any_of(", "), boost::token_compress_on);
-        for (auto rn : regnrs) {
-            count += SWISSMEDIC::countRowsWithRn(rn);
-        }
+    std::vector<std::string> regnrs;
+    boost::algorithm::split(regnrs, m.regnrs, boost::is_any_of(", "), boost::token_compress_on);
+    for (auto rn : regnrs) {
+        count += SWISSMEDIC::countRowsWithRn(rn);
     }
     return count;
 }
@@ -135,7 +149,13 @@ std::string getBarcodesFromGtins(const GTIN::oneFachinfoPackages &packages)
         if (i < packages.name.size()) // possibly redundant check
             html += "  <p class=\"spacing1\">" + packages.name[i++] + "</p>\n";
         
-        std::string svg = EAN13::createSvg("", gtin);
+        std::string svg;
+        {
+            // The barcode library is not known to be reentrant
+            static std::mutex barcodeMutex;
+            std::lock_guard<std::mutex> lock(barcodeMutex);
+            svg = EAN13::createSvg("", gtin);
+        }
         // TODO: onmouseup="addShoppingCart(this)"
         html += "<p class=\"barcode\">" + svg + "</p>\n";
     }
@@ -321,7 +341,10 @@ static void cleanupSection_not1_Title(std::string &title,
     cleanupSection_not1_Title(title);
     
     if (title.find(TITLES_STR_SEPARATOR) != std::string::npos) {
-        statsTitleStrSeparatorMap.insert(std::make_pair(regnrs, title));
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            statsTitleStrSeparatorMap.insert(std::make_pair(regnrs, title));
+        }
         
         // Replace section separator ";" with something else
         // (not ',' because it's the decimal point separator on some locales)
@@ -875,7 +898,7 @@ doExtraSections:
     // PedDose
     if (!atc.empty())
     {
-        std::string pedHtml = PED::getHtmlByAtc(atc);
+        std::string pedHtml = PED::getHtmlByAtc(atc, language);
         if (!pedHtml.empty()) {
             std::string sectionPedDose("Section" + std::to_string(SECTION_NUMBER_PEDDOSE));
             std::string sectionPedDoseName("Swisspeddose");
@@ -898,7 +921,7 @@ doExtraSections:
     // Sappinfo
     if (!atc.empty() && !skipSappinfo)
     {
-        std::string sappHtml = SAPP::getHtmlByAtc(atc);
+        std::string sappHtml = SAPP::getHtmlByAtc(atc, language);
         if (!sappHtml.empty()) {
 #ifdef SAPPINFO_OLD_STATS
             statsSappinfoSectionsCreated++; // Issue #70
@@ -927,7 +950,10 @@ doExtraSections:
         html += "   <div class=\"paragraph\" id=\"Section" + std::to_string(SECTION_NUMBER_FOOTER) + "\"></div>\n";
 
         std::time_t seconds = std::time(nullptr);
-        std::string curtime = std::asctime(std::localtime( &seconds )); // TODO: avoid trailing \n
+        std::tm tm;
+        char buf[32];
+        localtime_r(&seconds, &tm);  // reentrant versions
+        std::string curtime = asctime_r(&tm, buf); // TODO: avoid trailing \n
         std::string url("https://github.com/zdavatz/");
         url += appName;
         html += "<p class=\"footer\">Auto-generated by <a href=\"" + url + "\">" + appName + "</a> on " + curtime + "</p>";
@@ -938,6 +964,379 @@ doExtraSections:
     html += "\n</html>";
 }
 
+#pragma mark -
+
+// With the category the package info line was priced with
+static AIPS::PackageRow getPackageRow(const std::string &gtin,
+                                      const std::string &category)
+{
+    SWISSMEDIC::dosageUnits du = SWISSMEDIC::getByGtin(gtin);
+    BAG::packageFields pf = BAG::getPackageFieldsByGtin(gtin, category);
+
+    AIPS::PackageRow pr;
+    pr.gtin = gtin;
+    pr.phar = REFDATA::getPharByGtin(gtin);
+    pr.dosage = du.dosage;
+    pr.units = du.units;
+    pr.efp = pf.efp;
+    pr.pp = pf.pp;
+
+    // In the Java db there are 2 commas or 3 if there is SL
+    pr.flags = boost::algorithm::join(pf.flags, ",");
+    return pr;
+}
+
+// One line of the amikodb packages column
+static std::string getPackagesLine(const std::string &name,
+                                   const AIPS::PackageRow &pr)
+{
+    // Field 0
+    // TODO: temporarily use the first part of the name
+    std::string::size_type len = name.find(",");
+    std::string oneLine = name.substr(0, len);  // pos, len
+
+    oneLine += "|";
+    
+    // Field 1
+    oneLine += pr.dosage;
+    oneLine += "|";
+
+    // Field 2
+    oneLine += pr.units;
+    oneLine += "|";
+
+    // Field 3
+    if (!pr.efp.empty())
+        oneLine += "CHF " + pr.efp;
+
+    oneLine += "|";
+
+    // Field 4
+    if (!pr.pp.empty())
+        oneLine += "CHF " + pr.pp;
+
+    // Fields 5,6,7
+    // no FAP FEP VAT
+    oneLine += "||||";
+
+    // Field 8
+    oneLine += pr.flags;
+    oneLine += "|";
+
+    // Field 9
+    oneLine += pr.gtin;
+    oneLine += "|";
+    
+    // Field 10
+    oneLine += pr.phar;
+
+    // Fields 11 and 12
+    oneLine += "|255|0";    // visibility flag, free samples
+
+    return oneLine;
+}
+
+// Every package known to refdata, swissmedic or BAG, also those without Fachinfo
+// Must be called within the bulk load of amikodb
+// Return the number of rows
+static unsigned int populateProducts(AIPS::Database &db,
+                                     const std::string &language)
+{
+    GTIN::products products;
+    std::set<std::string> gtinUsedSet;
+    REFDATA::getProducts(gtinUsedSet, products, language);
+    SWISSMEDIC::getProducts(gtinUsedSet, products, language);
+    BAG::getProducts(gtinUsedSet, products, language);
+
+    for (size_t i=0; i < products.gtin.size(); i++) {
+        const std::string &gtin = products.gtin[i];
+
+        AIPS::ProductRow row;
+        row.title = products.name[i];
+        row.author = products.author[i];
+        if (row.author.empty())
+            row.author = SWISSMEDIC::getOwnerByGtin(gtin);
+
+        row.eancodes = gtin;
+        row.packages = getPackagesLine(products.packInfo[i], getPackageRow(gtin, products.category[i]));
+        row.packInfo = std::move(products.packInfo[i]);
+        AIPS::insertProduct(db, std::move(row));
+    }
+
+    return products.gtin.size();
+}
+
+// Size and modification time of the other input files the HTML depends on
+// The files themselves are read only by their parsers
+static std::string getInputFilesStamp(const std::string &workDirectory,
+                                      const std::string &inputDirectory,
+                                      bool noSappinfo)
+{
+    std::vector<std::string> files {
+        workDirectory + "/downloads/swisspeddosepublication.xml",
+        inputDirectory + "/atc_codes_multi_lingual.txt"
+    };
+    if (!noSappinfo)
+        files.push_back(inputDirectory + "/sappinfo.xlsx");
+
+    std::string stamp;
+    for (auto f : files) {
+        boost::system::error_code ec;
+        boost::uintmax_t size = boost::filesystem::file_size(f, ec);
+        if (ec)
+            size = 0;
+
+        std::time_t modified = boost::filesystem::last_write_time(f, ec);
+        if (ec)
+            modified = 0;
+
+        stamp += f + " " + std::to_string(size) + " " + std::to_string(modified) + "\n";
+    }
+
+    return stamp;
+}
+
+// Fingerprint of what the HTML depends on, other than the monograph itself
+static std::string getInputsHash(const std::string &inputFilesStamp,
+                                 const std::string &language,
+                                 bool noSappinfo)
+{
+    AIPS::Hash h;
+    h.add(PROJECT_VER);
+    h.add(RENDER_FORMAT_VERSION);
+    h.add(language);
+    h.add(noSappinfo ? "without-sappinfo" : "");
+    h.add(inputFilesStamp);
+    return h.str();
+}
+
+// A queue that is often full waits for the stage after it,
+// one that is often empty for the stage before it
+static void printQueueStats(const std::string &name,
+                            const PAR::QueueStats &qs)
+{
+    std::ostringstream average;
+    average << std::fixed << std::setprecision(1) << qs.averageDepth();
+    REP::html_li(name + ": average depth " + average.str() +
+                 ", max " + std::to_string(qs.maxDepth) +
+                 " of " + std::to_string(qs.capacity) +
+                 ", full " + std::to_string(qs.producerWaits) +
+                 " times, empty " + std::to_string(qs.consumerWaits) + " times");
+}
+
+// One monograph on its way to amikodb
+struct MonographJob
+{
+    size_t seq = 0;             // position in aips.xml, rows are written in this order
+    bool skip = false;          // regnr 00000
+    bool unchanged = false;     // same hash as in the previous run, no HTML rendered
+    sqlite3_int64 rowId = 0;    // _id in the previous run, 0 for a new row
+    AIPS::AmikoRow row;
+
+    // Needed by renderMonograph()
+    AIPS::Medicine medicine;
+    GTIN::oneFachinfoPackages packages;
+
+    // Usage stats, added up in aips.xml order by the thread writing the rows
+    unsigned int rnFoundRefdataCount = 0;
+    unsigned int rnNotFoundRefdataCount = 0;
+    unsigned int rnFoundSwissmedicCount = 0;
+    unsigned int rnNotFoundSwissmedicCount = 0;
+    unsigned int rnFoundBagCount = 0;
+    unsigned int rnNotFoundBagCount = 0;
+    std::vector<std::string> regnrsNotFound;
+};
+
+// The pipeline and the database of one language
+struct LanguageBuild
+{
+    explicit LanguageBuild(unsigned int jobs)
+    : parsedQueue(PIPELINE_QUEUE_SIZE),
+      enrichedQueue(PIPELINE_QUEUE_SIZE),
+      renderedQueue(PIPELINE_QUEUE_SIZE + jobs)
+    {
+    }
+
+    PAR::BoundedQueue<AIPS::Medicine> parsedQueue;
+    PAR::BoundedQueue<MonographJob> enrichedQueue;
+    PAR::ReorderQueue<MonographJob> renderedQueue;
+    unsigned int statsAipsPackagesInSwissmedic = 0;
+
+    std::string report;     // its part of the "Usage" section
+    bool published = false;
+};
+
+// Pipeline stage "enrich": everything but the HTML
+// It must not write to the database and reads previousMap only
+static MonographJob enrichMonograph(AIPS::Medicine &&medicine,
+                                    const std::string &key,
+                                    const std::map<std::string, AIPS::AmikoHash> &previousMap,
+                                    bool inputsChanged,
+                                    const std::string &language)
+{
+    MonographJob job;
+    job.medicine = std::move(medicine);
+    AIPS::Medicine &m = job.medicine;
+    AIPS::AmikoRow &row = job.row;
+
+    // For each regnr in the vector add the name(s) from refdata
+    std::vector<std::string> regnrs;
+    boost::algorithm::split(regnrs, m.regnrs, boost::is_any_of(", "), boost::token_compress_on);
+    //std::cerr << basename((char *)__FILE__) << ":" << __LINE__  << ", regnrs size: " << regnrs.size() << std::endl;
+
+    if (regnrs[0] == "00000") {
+        job.skip = true;
+        return job;
+    }
+
+    row.title = m.title;
+    row.auth = m.auth;
+    row.atc = m.atc;
+    row.substances = m.subst;
+    row.regnrs = m.regnrs;
+
+    // atc_class
+    row.atcClass = ATC::getClassByAtcColumn(m.atc, language);
+
+    // tindex_str
+    row.tindex = BAG::getTindex(regnrs[0], language);
+
+    // application_str
+    {
+    std::string application = SWISSMEDIC::getApplication(regnrs[0]);
+    std::string appBag = BAG::getApplication(regnrs[0], language);
+    if (!appBag.empty())
+        application += ";" + appBag;
+
+    row.application = std::move(application);
+    }
+
+    // TODO: indications_str
+
+    // TODO: customer_id  // "0"
+
+#if 1
+    // pack_info_str
+    GTIN::oneFachinfoPackages &packages = job.packages;
+    std::set<std::string> gtinUsedSet; // To ensure we don't have duplicates, and for stats
+    for (auto rn : regnrs) {
+        //std::cerr << basename((char *)__FILE__) << ":" << __LINE__  << " rn: " << rn << std::endl;
+
+        // Search in refdata
+        int nAdd = REFDATA::getNames(rn, gtinUsedSet, packages, language);
+        if (nAdd == 0)
+            job.rnNotFoundRefdataCount++;
+        else
+            job.rnFoundRefdataCount++;
+
+        // Search in swissmedic
+        nAdd = SWISSMEDIC::getAdditionalNames(rn, gtinUsedSet, packages, language);
+        if (nAdd == 0)
+            job.rnNotFoundSwissmedicCount++;
+        else
+            job.rnFoundSwissmedicCount++;
+
+        // Search in bag
+        nAdd = BAG::getAdditionalNames(rn, gtinUsedSet, packages, language);
+        if (nAdd == 0)
+            job.rnNotFoundBagCount++;
+        else
+            job.rnFoundBagCount++;
+
+        if (gtinUsedSet.empty())
+            job.regnrsNotFound.push_back(rn);
+    } // for
+
+    BEAUTY::sort(packages);
+
+    // Create a single multi-line string from the vector
+    row.packInfo = boost::algorithm::join(packages.name, "\n");
+#endif
+
+    // packages
+    {
+        // The line order must be the same as pack_info_str
+        std::vector<std::string>::iterator itGtin = packages.gtin.begin();
+        std::vector<std::string>::iterator itCategory = packages.category.begin();
+        std::vector<std::string> lines;
+        for (auto name : packages.name) {
+            AIPS::PackageRow pr = getPackageRow(*itGtin, *itCategory);
+            lines.push_back(getPackagesLine(name, pr));
+            row.packageRows.push_back(std::move(pr));
+            itGtin++;
+            itCategory++;
+        }
+
+        // Create a single multi-line string from the vector
+        row.packages = boost::algorithm::join(lines, "\n");
+    }
+
+    // Skip the HTML if nothing changed since the previous run
+    // The rendered HTML can't be compared: its footer has a time stamp
+    {
+        row.key = key;
+
+        AIPS::Hash h;
+        for (auto field : {&m.title, &m.auth, &m.atc, &m.subst, &m.regnrs, &m.content,
+                           &row.atcClass, &row.tindex, &row.application,
+                           &row.packInfo, &row.packages})
+            h.add(*field);
+
+        row.hash = h.str();
+
+        auto prev = previousMap.find(row.key);
+        if (prev != previousMap.end()) {
+            job.rowId = prev->second.id;
+            if (!inputsChanged && (prev->second.hash == row.hash))
+                job.unchanged = true;
+        }
+    }
+
+    return job;
+}
+
+// Pipeline stage "render", on any of the rendering threads
+static void renderMonograph(MonographJob &job,
+                            const std::string &language,
+                            bool verbose,
+                            bool skipSappinfo)
+{
+    AIPS::Medicine &m = job.medicine;
+    AIPS::AmikoRow &row = job.row;
+
+    // TODO: add_info__str
+
+    // content
+    auto firstAtc = ATC::getFirstAtcInAtcColumn(m.atc);
+    if (firstAtc.empty()) {
+#ifdef DEBUG
+        std::clog << basename((char *)__FILE__) << ":" << __LINE__
+        << ", title: <" << m.title << ">"
+        << ", atc: <" << m.atc << ">"     // nicht vergeben
+        << std::endl;
+#endif
+    }
+
+    std::vector<std::string> sectionId;    // HTML section IDs
+    std::vector<std::string> sectionTitle; // HTML section titles
+    getHtmlFromXml(m.content, row.content, m.regnrs, m.auth,
+                   job.packages,    // for barcodes
+                   sectionId,       // for ids_str
+                   sectionTitle,    // for titles_str
+                   firstAtc,        // for pedDose
+                   language,        // for barcode section
+                   verbose,
+                   skipSappinfo);
+
+    // ids_str
+    row.ids = boost::algorithm::join(sectionId, ",");
+
+    // titles_str
+    row.titles = boost::algorithm::join(sectionTitle, TITLES_STR_SEPARATOR);
+
+    // TODO: style_str
+}
+
 #pragma mark - main
 
 int main(int argc, char **argv)
@@ -952,6 +1351,15 @@ int main(int argc, char **argv)
     bool flagXml = false;
     bool flagVerbose = false;
     bool flagNoSappinfo = false;
+    bool flagNoFullText = false;
+    bool flagVacuum = false;
+    bool flagInMemory = false;
+    bool flagIncremental = false;
+    bool flagZip = false;
+    int exitStatus = EXIT_SUCCESS;
+    int opt_pageSize = 0;
+    unsigned int opt_jobs = 0;
+    AIPS::SchemaMode schemaMode = AIPS::SchemaMode::single;
     //bool flagPinfo = false;
     std::string type("fi"); // Fachinfo
     std::string opt_aplha;
@@ -965,8 +1373,17 @@ int main(int argc, char **argv)
         ("version,v", "print the version information and exit")
         ("verbose", "be extra verbose") // Show errors and logs
         ("without-sappinfo", "don't include sappinfo section")
+        ("without-fts", "don't create the full text index amikodb_fts")
+        ("vacuum", "compact the database after populating it")
+        ("in-memory", "build the database in memory, then write it to disk")
+        ("incremental", "update only the monographs that changed since the previous database")
+        ("pageSize", po::value<int>( &opt_pageSize )->default_value(0), "page size of the compacted database (implies --vacuum)")
+        ("jobs", po::value<unsigned int>( &opt_jobs )->default_value(0), "number of threads rendering the monographs and compressing the databases, 0 for one per core")
+        ("zip", "also write each database compressed, as amiko_db_full_idx_<lang>.zip")
+        ("split-content", "store content in table amikodb_content, amikodb becomes a view")
+        ("split-packages", "store packages in table amikodb_content as well (implies --split-content)")
 //        ("nodown", "no download, parse only")
-        ("lang", po::value<std::string>( &opt_language )->default_value("de"), "use given language (de/fr)")
+        ("lang", po::value<std::string>( &opt_language )->default_value("de"), "use given language(s) (de/fr), comma separated to build several databases in one run")
 //        ("alpha", po::value<std::string>( &opt_aplha ), "only include titles which start with arg value")  // Med title
 //        ("regnr", po::value<std::string>( &opt_regnr ), "only include medications which start with arg value") // Med regnr
 //        ("owner", po::value<std::string>( &opt_owner ), "only include medications owned by arg value") // Med owner
@@ -984,7 +1401,6 @@ int main(int argc, char **argv)
 //        ("dailydrugcosts", "calculates the daily drug costs")
 //        ("smsequence", "generates swissmedic sequence csv")
 //        ("packageparse", "extract dosage information from package name")
-//        ("zip", "generate zipped big files (sqlite or xml)")
 //        ("reports", "generates various reports")
 //        ("indications", "generates indications section keywords report")
 //        ("plain", "does not update the package section")
@@ -1033,6 +1449,34 @@ int main(int argc, char **argv)
         flagNoSappinfo = true;
     }
 
+    if (vm.count("without-fts")) {
+        flagNoFullText = true;
+    }
+
+    if (vm.count("vacuum")) {
+        flagVacuum = true;
+    }
+
+    if (vm.count("in-memory")) {
+        flagInMemory = true;
+    }
+
+    if (vm.count("incremental")) {
+        flagIncremental = true;
+    }
+
+    if (vm.count("zip")) {
+        flagZip = true;
+    }
+
+    if (opt_jobs == 0)
+        opt_jobs = PAR::defaultJobs();
+
+    if (vm.count("split-packages"))
+        schemaMode = AIPS::SchemaMode::splitContentPackages;
+    else if (vm.count("split-content"))
+        schemaMode = AIPS::SchemaMode::splitContent;
+
     if (vm.count("xml")) {
         flagXml = true;
         std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << " flagXml: " << flagXml << std::endl;
@@ -1048,11 +1492,18 @@ int main(int argc, char **argv)
         opt_workDirectory = opt_inputDirectory + "/..";
     }
 
-    std::string reportFilename("amiko_report_" + opt_language + ".html");
-    std::string language = opt_language;
-    boost::to_upper(language);
+    // The input files are read once for all the languages
+    const std::vector<std::string> languages = LOC::split(opt_language);
+    if (languages.empty()) {
+        std::cerr << "Error: no language given with --lang" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string reportFilename("amiko_report_" + boost::algorithm::join(languages, "_") + ".html");
+    std::string reportLanguage = boost::algorithm::join(languages, "/");
+    boost::to_upper(reportLanguage);
     //ofs2 << "<title>" << title << " Report " << language << "</title>";
-    std::string reportTitle("AmiKo Report " + language);
+    std::string reportTitle("AmiKo Report " + reportLanguage);
     REP::init(opt_workDirectory + "/output/", reportFilename, reportTitle, flagVerbose);
     REP::html_start_ul();
     for (int i=0; i<argc; i++)
@@ -1069,53 +1520,177 @@ int main(int argc, char **argv)
     EPHA::parseJSON(opt_workDirectory + "/downloads" + jsonFilename, flagVerbose);
 #endif
     
-    PED::parseXML(opt_workDirectory + "/downloads/swisspeddosepublication.xml",
-                  opt_language);
+    // The input files are read ahead on a background thread, in the order
+    // the parsers need them. aips.xml is too big to be kept in memory,
+    // the system reads it ahead for the parser that streams it
+    {
+        std::vector<std::string> prefetchFiles {
+            opt_workDirectory + "/downloads/swisspeddosepublication.xml",
+            opt_workDirectory + "/downloads/swissmedic_packages.xlsx",
+            opt_inputDirectory + "/atc_codes_multi_lingual.txt",
+            opt_workDirectory + "/downloads/refdata_pharma.xml",
+            opt_workDirectory + "/downloads/bag_preparations.xml"
+        };
+        if (!flagNoSappinfo)
+            prefetchFiles.push_back(opt_inputDirectory + "/sappinfo.xlsx");
+
+        LOADER::prefetch(prefetchFiles);
+        if (!flagXml)
+            LOADER::readAhead(opt_workDirectory + "/downloads/aips.xml");
+    }
+
+    // The input files are loaded in parallel, each one as soon as the files
+    // it depends on have been loaded. Their report sections are kept in memory
+    // and printed in this order by printSourceReports()
+    const std::vector<std::string> sourceOrder {"PED", "SWISSMEDIC", "ATC", "AIPS", "REFDATA", "BAG", "SAPP"};
+    std::map<std::string, std::string> sourceReportMap;
+    std::mutex sourceReportMutex;
+    PAR::TaskGraph loaders;
+    auto addLoader = [&](const std::string &name,
+                         const std::vector<std::string> &dependencies,
+                         std::function<void()> load) {
+        loaders.add(name, dependencies, [&, name, load] {
+            REP::beginBuffer();
+            load();
+            std::string html = REP::endBuffer();
+
+            std::lock_guard<std::mutex> lock(sourceReportMutex);
+            sourceReportMap[name] = html;
+        });
+    };
+
+    addLoader("PED", {}, [&] {
+        PED::parseXML(opt_workDirectory + "/downloads/swisspeddosepublication.xml",
+                      languages);
 #ifdef DEBUG_PED_DOSE
-    PED::showPedDoseByAtc("N02BA01");
-    PED::showPedDoseByAtc("J05AB01");
-    PED::showPedDoseByAtc("N02BE01"); // Acetalgin, RN 34186,62355,49493
+        PED::showPedDoseByAtc("N02BA01", languages[0]);
+        PED::showPedDoseByAtc("J05AB01", languages[0]);
+        PED::showPedDoseByAtc("N02BE01", languages[0]); // Acetalgin, RN 34186,62355,49493
 #endif
+    });
+
+    addLoader("SWISSMEDIC", {}, [&] {
+        SWISSMEDIC::parseXLXS(opt_workDirectory + "/downloads/swissmedic_packages.xlsx");
+    });
+
+    addLoader("ATC", {}, [&] {
+        ATC::parseTXT(opt_inputDirectory + "/atc_codes_multi_lingual.txt", languages, flagVerbose);
+    });
+
+    // Pipeline: parse -> enrich -> render -> write
+    // Each stage has its own thread(s), so that reading aips.xml, rendering
+    // and writing to the database overlap. The render stage has 'opt_jobs'
+    // threads, the reorder queue puts the rows back in aips.xml order,
+    // so that the _id values are the same as with a single thread.
+    // Each language has its own pipeline, fed by the same parse stage.
+    std::map<std::string, LanguageBuild> buildMap;
+    for (auto language : languages)
+        buildMap.try_emplace(language, opt_jobs);
+
+    // Stage "parse"
+    // AIPS might need to get missing ATC codes from swissmedic, and ATC texts from peddose
+    if (!flagXml) {
+        addLoader("AIPS", {"PED", "SWISSMEDIC", "ATC"}, [&] {
+            AIPS::parseXML(opt_workDirectory + "/downloads/aips.xml",
+                           languages,
+                           type,
+                           flagVerbose,
+                           opt_jobs,
+                           [&](const std::string &language, AIPS::Medicine &&m) {
+                LanguageBuild &build = buildMap.at(language);
+                build.statsAipsPackagesInSwissmedic += countAipsPackagesInSwissmedic(m);
+                build.parsedQueue.push(std::move(m));
+            });
+
+            for (auto &b : buildMap)
+                b.second.parsedQueue.close();
+        });
+    }
 
-    // Read swissmedic next, because aips might need to get missing ATC codes from it
-    SWISSMEDIC::parseXLXS(opt_workDirectory + "/downloads/swissmedic_packages.xlsx");
+    addLoader("REFDATA", {}, [&] {
+        REFDATA::parseXML(opt_workDirectory + "/downloads/refdata_pharma.xml", languages);
+    });
 
-    ATC::parseTXT(opt_inputDirectory + "/atc_codes_multi_lingual.txt", opt_language, flagVerbose);
+    addLoader("BAG", {}, [&] {
+        BAG::parseXML(opt_workDirectory + "/downloads/bag_preparations.xml", languages, flagVerbose);
+    });
 
-    AIPS::MedicineList &list = AIPS::parseXML(opt_workDirectory + "/downloads/aips.xml",
-                                              opt_language,
-                                              type,
-                                              flagVerbose);
+    if (!flagNoSappinfo) {
+        addLoader("SAPP", {}, [&] {
+            SAPP::parseXLXS(opt_inputDirectory, "/sappinfo.xlsx", languages);
+        });
+    }
 
-    REP::html_p("Swissmedic has " + std::to_string(countAipsPackagesInSwissmedic(list)) + " matching packages");
-    
-    REFDATA::parseXML(opt_workDirectory + "/downloads/refdata_pharma.xml", opt_language);
+    loaders.run();
 
-    BAG::parseXML(opt_workDirectory + "/downloads/bag_preparations.xml", opt_language, flagVerbose);
-    {
-        std::vector<std::string> bagList = BAG::getGtinList();
-        REP::html_h4("Cross-reference");
+    auto printSourceReports = [&] {
+        loaders.waitAll();
+
+        for (auto name : sourceOrder) {
+            REP::html_raw(sourceReportMap[name]);
+
+            if (name == "AIPS" && !flagXml)
+                for (auto language : languages)
+                    REP::html_p("Swissmedic has " + std::to_string(buildMap.at(language).statsAipsPackagesInSwissmedic) + " matching packages (" + language + ")");
+
+            if (name == "BAG") {
+                std::vector<std::string> bagList = BAG::getGtinList();
+                REP::html_h4("Cross-reference");
+                REP::html_start_ul();
+                REP::html_li(std::to_string(countBagGtinInSwissmedic(bagList)) + " GTIN are also in swissmedic");
+                REP::html_li(std::to_string(countBagGtinInRefdata(bagList)) + " GTIN are also in refdata");
+                REP::html_end_ul();
+            }
+        }
+
+        REP::html_h2("Loading");
         REP::html_start_ul();
-        REP::html_li(std::to_string(countBagGtinInSwissmedic(bagList)) + " GTIN are also in swissmedic");
-        REP::html_li(std::to_string(countBagGtinInRefdata(bagList)) + " GTIN are also in refdata");
+        double total = 0;
+        for (auto t : loaders.getTimings()) {
+            std::ostringstream times;
+            times << std::fixed << std::setprecision(3)
+                  << t.seconds << " s, from " << t.start << " s";
+            REP::html_li(t.name + ": " + times.str());
+            total = std::max(total, t.start + t.seconds);
+        }
+
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(3) << total << " s";
+        REP::html_li("all: " + s.str());
         REP::html_end_ul();
-    }
-    
-    if (!flagNoSappinfo)
-        SAPP::parseXLXS(opt_inputDirectory, "/sappinfo.xlsx", opt_language);
 
-    if (flagXml) {
-        std::cerr << "Creating XML not yet implemented" << std::endl;
-    }
-    else {
-        std::string dbFilename = opt_workDirectory + "/output/amiko_db_full_idx_" + opt_language + ".db";
-        sqlite3 *db = AIPS::createDB(dbFilename);
+        LOADER::printFileStats();
+    };
+
+    // The same for all the languages
+    const std::string inputFilesStamp = getInputFilesStamp(opt_workDirectory, opt_inputDirectory, flagNoSappinfo);
+
+    // Build one database, on its own thread, with its part of the report
+    // kept in build.report
+    auto buildDatabase = [&](const std::string &language, LanguageBuild &build) {
+        REP::beginBuffer();
 
-        sqlite3_stmt *statement;
-        AIPS::prepareStatement("amikodb", &statement,
-                               "null, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?");
+        std::string dbFilename = opt_workDirectory + "/output/amiko_db_full_idx_" + language + ".db";
+        AIPS::Database db(dbFilename, flagInMemory);
+
+        bool incremental = flagIncremental &&
+                           db.restore() &&
+                           AIPS::reopenDB(db, schemaMode, !flagNoFullText);
+        if (!incremental)
+            AIPS::createDB(db, schemaMode, !flagNoFullText);
+
+        // If anything else used for the HTML changed, all the rows must be rendered again
+        std::string inputsHash = getInputsHash(inputFilesStamp, language, flagNoSappinfo);
+        bool inputsChanged = AIPS::getBuildInfo(db, "inputs") != inputsHash;
+
+        std::map<std::string, AIPS::AmikoHash> previousMap = AIPS::getAmikoHashes(db);
+        unsigned int statsRowsUnchanged = 0;
+        unsigned int statsRowsUpdated = 0;
+        unsigned int statsRowsInserted = 0;
+        unsigned int statsRowsDeleted = 0;
 
         std::clog << std::endl << "Populating " << dbFilename << std::endl;
+        db.beginBulkLoad();
         unsigned int statsRnFoundRefdataCount = 0;
         unsigned int statsRnNotFoundRefdataCount = 0;
         unsigned int statsRnFoundSwissmedicCount = 0;
@@ -1124,222 +1699,113 @@ int main(int argc, char **argv)
         unsigned int statsRnNotFoundBagCount = 0;
         std::vector<std::string> statsRegnrsNotFound;
 
+        std::set<std::string> keySeenSet;
+
+        std::vector<std::thread> stageThreads;
+
+        // Stage "enrich"
+        stageThreads.emplace_back([&] {
+            loaders.wait({"REFDATA", "SWISSMEDIC", "BAG", "ATC"});
+
+            // Row keys depend on the order in aips.xml
+            std::map<std::string, int> keyCountMap;
+            size_t seq = 0;
+            while (std::optional<AIPS::Medicine> m = build.parsedQueue.pop()) {
+                std::string key = m->regnrs + "#" + std::to_string(keyCountMap[m->regnrs]++);
+                MonographJob job = enrichMonograph(std::move(*m), key, previousMap, inputsChanged, language);
+                job.seq = seq++;
+                build.enrichedQueue.push(std::move(job));
+            }
+            build.enrichedQueue.close();
+        });
+
+        // Stage "render"
+        std::atomic<unsigned int> renderThreadsLeft{opt_jobs};
+        for (unsigned int t = 0; t < opt_jobs; t++) {
+            stageThreads.emplace_back([&] {
+                loaders.wait({"PED", "ATC", "SAPP"});
+
+                while (std::optional<MonographJob> job = build.enrichedQueue.pop()) {
+                    if (!job->skip && !job->unchanged)
+                        renderMonograph(*job, language, flagVerbose, flagNoSappinfo);
+
+                    size_t seq = job->seq;
+                    build.renderedQueue.push(seq, std::move(*job));
+                }
+
+                if (--renderThreadsLeft == 0)
+                    build.renderedQueue.close();
+            });
+        }
+
+        // Stage "write", on this thread because it owns the database
 #ifdef WITH_PROGRESS_BAR
         int ii=1;
-        int n=list.size();
 #endif
-        for (AIPS::Medicine m : list) {
+        while (std::optional<MonographJob> job = build.renderedQueue.pop()) {
             
 #ifdef WITH_PROGRESS_BAR
             // Show progress
             if ((ii++ % 60) == 0)
-                std::cerr << "\r" << 100*ii/n << " % ";
+                std::cerr << "\r" << ii << " ";
 #endif
 
-            // For each regnr in the vector add the name(s) from refdata
-            std::vector<std::string> regnrs;
-            boost::algorithm::split(regnrs, m.regnrs, boost::is_any_of(", "), boost::token_compress_on);
-            //std::cerr << basename((char *)__FILE__) << ":" << __LINE__  << ", regnrs size: " << regnrs.size() << std::endl;
-            
-            if (regnrs[0] == "00000")
+            if (job->skip)
                 continue;
 
-            // See DispoParse.java:164 addArticleDB()
-            // See SqlDatabase.java:347 addExpertDB()
-            AIPS::bindText("amikodb", statement, 1, m.title);
-            AIPS::bindText("amikodb", statement, 2, m.auth);
-            AIPS::bindText("amikodb", statement, 3, m.atc);
-            AIPS::bindText("amikodb", statement, 4, m.subst);
-            AIPS::bindText("amikodb", statement, 5, m.regnrs);
-            
-            // atc_class
-            std::string atcClass = ATC::getClassByAtcColumn(m.atc);
-            AIPS::bindText("amikodb", statement, 6, atcClass);
-
-            // tindex_str
-            std::string tindex = BAG::getTindex(regnrs[0]);
-            if (tindex.empty())
-                AIPS::bindText("amikodb", statement, 7, "");
-            else
-                AIPS::bindText("amikodb", statement, 7, tindex);
-
-            // application_str
-            {
-            std::string application = SWISSMEDIC::getApplication(regnrs[0]);
-            std::string appBag = BAG::getApplication(regnrs[0]);
-            if (!appBag.empty())
-                application += ";" + appBag;
-
-            if (application.empty())
-                AIPS::bindText("amikodb", statement, 8, "");
-            else
-                AIPS::bindText("amikodb", statement, 8, application);
-            }
-            
-            // TODO: indications_str
-            AIPS::bindText("amikodb", statement, 9, "");
-            
-            // TODO: customer_id
-            AIPS::bindText("amikodb", statement, 10, "");  // "0"
-
-#if 1
-            // pack_info_str
-            GTIN::oneFachinfoPackages packages;
-            std::set<std::string> gtinUsedSet; // To ensure we don't have duplicates, and for stats
-            for (auto rn : regnrs) {
-                //std::cerr << basename((char *)__FILE__) << ":" << __LINE__  << " rn: " << rn << std::endl;
-
-                // Search in refdata
-                int nAdd = REFDATA::getNames(rn, gtinUsedSet, packages);
-                if (nAdd == 0)
-                    statsRnNotFoundRefdataCount++;
-                else
-                    statsRnFoundRefdataCount++;
-
-                // Search in swissmedic
-                nAdd = SWISSMEDIC::getAdditionalNames(rn, gtinUsedSet, packages, opt_language);
-                if (nAdd == 0)
-                    statsRnNotFoundSwissmedicCount++;
-                else
-                    statsRnFoundSwissmedicCount++;
-
-                // Search in bag
-                nAdd = BAG::getAdditionalNames(rn, gtinUsedSet, packages);
-                if (nAdd == 0)
-                    statsRnNotFoundBagCount++;
-                else
-                    statsRnFoundBagCount++;
-
-                if (gtinUsedSet.empty())
-                    statsRegnrsNotFound.push_back(rn);
-            } // for
-
-            BEAUTY::sort(packages);
-
-            // Create a single multi-line string from the vector
-            std::string packInfo = boost::algorithm::join(packages.name, "\n");
-
-            if (packInfo.empty())
-                AIPS::bindText("amikodb", statement, 11, "");
-            else
-                AIPS::bindText("amikodb", statement, 11, packInfo);
-#endif
+            statsRnFoundRefdataCount += job->rnFoundRefdataCount;
+            statsRnNotFoundRefdataCount += job->rnNotFoundRefdataCount;
+            statsRnFoundSwissmedicCount += job->rnFoundSwissmedicCount;
+            statsRnNotFoundSwissmedicCount += job->rnNotFoundSwissmedicCount;
+            statsRnFoundBagCount += job->rnFoundBagCount;
+            statsRnNotFoundBagCount += job->rnNotFoundBagCount;
+            statsRegnrsNotFound.insert(statsRegnrsNotFound.end(),
+                                       job->regnrsNotFound.begin(),
+                                       job->regnrsNotFound.end());
 
-            // TODO: add_info__str
-            AIPS::bindText("amikodb", statement, 12, "");
+            keySeenSet.insert(job->row.key);
 
-            // content
-            auto firstAtc = ATC::getFirstAtcInAtcColumn(m.atc);
-            if (firstAtc.empty()) {
-#ifdef DEBUG
-                std::clog << basename((char *)__FILE__) << ":" << __LINE__
-                << ", title: <" << m.title << ">"
-                << ", atc: <" << m.atc << ">"     // nicht vergeben
-                << std::endl;
-#endif
+            if (job->unchanged) {
+                statsRowsUnchanged++;
+                continue;
             }
 
-            std::vector<std::string> sectionId;    // HTML section IDs
-            std::vector<std::string> sectionTitle; // HTML section titles
-            {
-                std::string html;
-                getHtmlFromXml(m.content, html, m.regnrs, m.auth,
-                               packages,        // for barcodes
-                               sectionId,       // for ids_str
-                               sectionTitle,    // for titles_str
-                               firstAtc,        // for pedDose
-                               opt_language,    // for barcode section
-                               flagVerbose,
-                               flagNoSappinfo);
-                AIPS::bindText("amikodb", statement, 15, html);
+            if (job->rowId > 0) {
+                AIPS::deleteAmiko(db, job->rowId);
+                statsRowsUpdated++;
             }
-            
-            // ids_str
-            {
-                std::string ids_str = boost::algorithm::join(sectionId, ",");
-                AIPS::bindText("amikodb", statement, 13, ids_str);
+            else {
+                statsRowsInserted++;
             }
 
-            // titles_str
-            {
-                std::string titles_str = boost::algorithm::join(sectionTitle, TITLES_STR_SEPARATOR);
-                AIPS::bindText("amikodb", statement, 14, titles_str);
-            }
-
-            // TODO: style_str
-
-            // packages
-            {
-                // The line order must be the same as pack_info_str
-                std::vector<std::string>::iterator itGtin = packages.gtin.begin();
-                std::vector<std::string> lines;
-                for (auto name : packages.name) {
-
-                    SWISSMEDIC::dosageUnits du = SWISSMEDIC::getByGtin(*itGtin);
-                    BAG::packageFields pf = BAG::getPackageFieldsByGtin(*itGtin);
-
-                    // Field 0
-                    // TODO: temporarily use the first part of the name
-                    std::string::size_type len = name.find(",");
-                    std::string oneLine = name.substr(0, len);  // pos, len
-
-                    oneLine += "|";
-                    
-                    // Field 1
-                    oneLine += du.dosage;
-                    oneLine += "|";
-
-                    // Field 2
-                    oneLine += du.units;
-                    oneLine += "|";
-
-                    // Field 3
-                    if (!pf.efp.empty())
-                        oneLine += "CHF " + pf.efp;
-
-                    oneLine += "|";
-
-                    // Field 4
-                    if (!pf.pp.empty())
-                        oneLine += "CHF " + pf.pp;
-
-                    // Fields 5,6,7
-                    // no FAP FEP VAT
-                    oneLine += "||||";
-
-                    // Field 8
-                    // In the Java db there are 2 commas or 3 if there is SL
-                    oneLine += boost::algorithm::join(pf.flags, ",");
-                    oneLine += "|";
+            AIPS::insertAmiko(db, std::move(job->row), job->rowId);
+        }
 
-                    // Field 9
-                    oneLine += *itGtin;
-                    oneLine += "|";
-                    
-                    // Field 10
-                    oneLine += REFDATA::getPharByGtin(*itGtin);
+        for (auto &t : stageThreads)
+            t.join();
 
-                    // Fields 11 and 12
-                    oneLine += "|255|0";    // visibility flag, free samples
+        // Monographs no longer in aips.xml
+        for (auto prev : previousMap) {
+            if (keySeenSet.find(prev.first) != keySeenSet.end())
+                continue;
 
-                    lines.push_back(oneLine);
-                    itGtin++;
-                }
-                
-                // Create a single multi-line string from the vector
-                std::string packages = boost::algorithm::join(lines, "\n");
+            AIPS::deleteAmiko(db, prev.second.id);
+            statsRowsDeleted++;
+        }
 
-                AIPS::bindText("amikodb", statement, 17, packages);
-            }
-            
-            AIPS::runStatement("amikodb", statement);
-        } // for
+        AIPS::setBuildInfo(db, "inputs", inputsHash);
         
 #ifdef WITH_PROGRESS_BAR
-        std::cerr << "\r100 %" << std::endl;
+        std::cerr << "\r" << ii << std::endl;
 #endif
-        REP::html_h1("Usage");
-        
+
+        std::clog << "Populating productdb " << language << std::endl;
+        unsigned int productCount = populateProducts(db, language);
+        db.endBulkLoad();
+
+        REP::html_h2("Database " + language);
+        REP::html_p(dbFilename);
+
         REP::html_h2("aips REGNRS (found/not found)");
         REP::html_start_ul();
         REP::html_li("in refdata: " + std::to_string(statsRnFoundRefdataCount) + "/" + std::to_string(statsRnNotFoundRefdataCount) + " (" + std::to_string(statsRnFoundRefdataCount + statsRnNotFoundRefdataCount) + ")");
@@ -1349,7 +1815,70 @@ int main(int argc, char **argv)
         REP::html_end_ul();
         if (statsRegnrsNotFound.size() > 0)
             REP::html_div(boost::algorithm::join(statsRegnrsNotFound, ", "));
-        
+
+        REP::html_h2("amikodb rows");
+        REP::html_start_ul();
+        REP::html_li(std::string("mode: ") + (incremental ? "incremental" : "full"));
+        REP::html_li("unchanged: " + std::to_string(statsRowsUnchanged));
+        REP::html_li("updated: " + std::to_string(statsRowsUpdated));
+        REP::html_li("inserted: " + std::to_string(statsRowsInserted));
+        REP::html_li("deleted: " + std::to_string(statsRowsDeleted));
+        REP::html_end_ul();
+
+        REP::html_h2("Pipeline");
+        REP::html_p("render threads: " + std::to_string(opt_jobs));
+        REP::html_start_ul();
+        printQueueStats("parse -> enrich", build.parsedQueue.getStats());
+        printQueueStats("enrich -> render", build.enrichedQueue.getStats());
+        printQueueStats("render -> write", build.renderedQueue.getStats());
+        REP::html_end_ul();
+
+        REP::html_h2("productdb");
+        REP::html_start_ul();
+        REP::html_li("rows: " + std::to_string(productCount));
+        REP::html_end_ul();
+
+        AIPS::finalizeDB(db, flagVacuum, opt_pageSize);
+        std::clog << "Writing " << dbFilename << std::endl;
+        build.published = db.publish();
+
+        // While the other languages are still being built
+        if (flagZip && build.published) {
+            std::string zipFilename = opt_workDirectory + "/output/amiko_db_full_idx_" + language + ".zip";
+            std::clog << "Compressing " << zipFilename << std::endl;
+            ZIP::Stats zipStats;
+            build.published = ZIP::zipFile(dbFilename, zipFilename, opt_jobs, zipStats);
+            if (build.published)
+                ZIP::printStats(zipFilename, opt_jobs, zipStats);
+        }
+
+        build.report = REP::endBuffer();
+    };
+
+    if (flagXml) {
+        printSourceReports();
+        std::cerr << "Creating XML not yet implemented" << std::endl;
+    }
+    else {
+        // The databases are built at the same time, because the parse stage
+        // feeds all of them and would wait on a full queue otherwise
+        std::vector<std::thread> buildThreads;
+        for (auto language : languages)
+            buildThreads.emplace_back(buildDatabase, language, std::ref(buildMap.at(language)));
+
+        for (auto &t : buildThreads)
+            t.join();
+
+        printSourceReports();
+
+        REP::html_h1("Usage");
+        for (auto language : languages) {
+            REP::html_raw(buildMap.at(language).report);
+            if (!buildMap.at(language).published)
+                exitStatus = EXIT_FAILURE;
+        }
+
+        // Combined for all the languages
         if (statsTitleStrSeparatorMap.size() > 0) {
             REP::html_h3("XML");
             REP::html_p("title_str separator '" + std::string(TITLES_STR_SEPARATOR) + "' was replaced for rgnrs");
@@ -1372,18 +1901,9 @@ int main(int argc, char **argv)
             REP::html_p("Sappinfo sections created: " + std::to_string(statsSappinfoSectionsCreated)); // Issue #70
 #endif
         }
-
-        AIPS::destroyStatement(statement);
-
-        int rc = sqlite3_close(db);
-        if (rc != SQLITE_OK)
-            std::cerr
-            << basename((char *)__FILE__) << ":" << __LINE__
-            << ", rc" << rc
-            << std::endl;
     }
 
     REP::terminate();
 
-    return EXIT_SUCCESS;
+    return exitStatus;
 }
@@ -10,6 +10,9 @@
 #include <iostream>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
 #include <libgen.h>     // for basename()
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -19,6 +22,7 @@
 #include "peddose.hpp"
 #include "atc.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 #include "html_tags.h"
 
@@ -43,9 +47,9 @@ namespace PED
     unsigned int statsCodeZEIT = 0; // Time
     
     // Usage stats
-    unsigned int statsCasesForAtcFoundCount = 0;
-    unsigned int statsCasesForAtcNotFoundCount = 0;
-    unsigned int statsTablesCount = 0;
+    std::atomic<unsigned int> statsCasesForAtcFoundCount{0};
+    std::atomic<unsigned int> statsCasesForAtcNotFoundCount{0};
+    std::atomic<unsigned int> statsTablesCount{0};
 
     std::vector<_case> caseVec;
     std::set<std::string> caseCaseIDSet; // TODO: obsolete
@@ -62,9 +66,13 @@ namespace PED
     //std::vector<_code> codeRoaVec;
     std::set<std::string> codeRoaCodeSet;
 
-    std::vector<_dosage> dosageVec;
+    std::vector<_dosage> dosageVec;     // grouped by case after parseXML()
     std::set<std::string> dosageCaseIDSet;// TODO: obsolete
 
+    // Built by parseXML(), read-only afterwards
+    std::multimap<std::string, size_t> atcCaseMap;  // cases of an ATC, in file order
+    std::unordered_map<std::string, std::pair<size_t, size_t>> caseDosageMap; // range of dosageVec
+
 #define TH_KEY_AGE      "age"
 #define TH_KEY_WEIGHT   "weight"
 #define TH_KEY_TYPE     "type"
@@ -90,12 +98,27 @@ namespace PED
         "Age", "Weight", "Type of use", "Dosage",
         "Daily repetitions", "ROA", "Max. daily dose", "Remark"
     };
-    std::map<std::string, std::string> thTitleMap;
-    std::string indicationTitle;
+    std::map<std::string, std::map<std::string, std::string>> thTitleMap; // key is language
+    LOC::Text indicationTitle;
+
+// Not with operator[], which would insert the missing keys:
+// the maps are read by several threads while the monographs are rendered
+static const std::string & getCodeDescription(const std::map<std::string, _code> &codeMap,
+                                              const std::string &key,
+                                              const std::string &language)
+{
+    static const std::string empty;
+    auto search = codeMap.find(key);
+    if (search == codeMap.end())
+        return empty;
 
-static std::string getAbbreviation(const std::string s)
+    return LOC::get(search->second.description, language);
+}
+
+static std::string getAbbreviation(const std::string s,
+                                   const std::string &language)
 {
-    return codeDosisUnitMap[s].description;
+    return getCodeDescription(codeDosisUnitMap, s, language);
 }
 
 static
@@ -161,37 +184,61 @@ void printUsageStats()
     REP::html_end_ul();
 }
 
+// The dosages of each case become adjacent, in their file order,
+// so that a case only needs the start and end of its range
+static void buildIndexes()
+{
+    for (size_t i = 0; i < caseVec.size(); i++)
+        atcCaseMap.emplace(caseVec[i].atcCode, i);
+
+    std::stable_sort(dosageVec.begin(), dosageVec.end(),
+                     [](const _dosage &a, const _dosage &b) {
+        return a.caseId < b.caseId;
+    });
+
+    for (size_t i = 0; i < dosageVec.size(); ) {
+        size_t j = i + 1;
+        while ((j < dosageVec.size()) && (dosageVec[j].caseId == dosageVec[i].caseId))
+            j++;
+
+        caseDosageMap.emplace(dosageVec[i].caseId, std::make_pair(i, j));
+        i = j;
+    }
+}
+
 void parseXML(const std::string &filename,
-              const std::string &language)
+              const std::vector<std::string> &languages)
 {
-    {
+    for (auto language : languages) {
         // Define localized lookup table for pedDose table header
-        std::vector<std::string> &th = th_en;
-        indicationTitle = "Indication";
+        const std::vector<std::string> *th = &th_en;
+        indicationTitle[language] = "Indication";
         if (language == "de") {
-            th = th_de;
-            indicationTitle = "Indikation";
+            th = &th_de;
+            indicationTitle[language] = "Indikation";
         }
         else if (language == "fr") {
-            th = th_fr;
-            indicationTitle = "Indication";
+            th = &th_fr;
+            indicationTitle[language] = "Indication";
         }
         
         for (int i=0; i< th_key.size(); i++)
-            thTitleMap.insert(std::make_pair(th_key[i], th[i]));
+            thTitleMap[language].insert(std::make_pair(th_key[i], (*th)[i]));
     }
 
     pt::ptree tree;
     
     try {
         std::clog << std::endl << "Reading Ped XML" << std::endl;
-        pt::read_xml(filename, tree);
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        pt::read_xml(stream, tree);
     }
     catch (std::exception &e) {
         std::cerr << "Line: " << __LINE__ << " Error " << e.what() << std::endl;
     }
     
-    std::clog << "Analyzing Ped " << language << std::endl;
+    std::clog << "Analyzing Ped" << std::endl;
     int i=0;
 
     try {
@@ -241,12 +288,14 @@ void parseXML(const std::string &filename,
             if (v.first == "Indication") {
 
                 _indication in;
-                if (language == "de")
-                    in.name = v.second.get("IndicationNameD", "");
-                else if (language == "fr")
-                    in.name = v.second.get("IndicationNameF", "");
-                else
-                    in.name = v.second.get("IndikationNameE", ""); // English has a K
+                for (auto language : languages) {
+                    if (language == "de")
+                        in.name[language] = v.second.get("IndicationNameD", "");
+                    else if (language == "fr")
+                        in.name[language] = v.second.get("IndicationNameF", "");
+                    else
+                        in.name[language] = v.second.get("IndikationNameE", ""); // English has a K
+                }
 
                 in.recStatus = v.second.get("RecStatus", "");
                 indicationMap.insert(std::make_pair(v.second.get("IndicationKey", ""), in));
@@ -260,12 +309,14 @@ void parseXML(const std::string &filename,
                 
                 _code co;
                 co.value = v.second.get("CodeValue", "");
-                if (language == "de")
-                    co.description = v.second.get("DescriptionD", "");
-                else if (language == "fr")
-                    co.description = v.second.get("DecsriptionF", "");  // Note: spelling mistake
-                else //if (language == "en")
-                    co.description = v.second.get("DecriptionE", "");
+                for (auto language : languages) {
+                    if (language == "de")
+                        co.description[language] = v.second.get("DescriptionD", "");
+                    else if (language == "fr")
+                        co.description[language] = v.second.get("DecsriptionF", "");  // Note: spelling mistake
+                    else //if (language == "en")
+                        co.description[language] = v.second.get("DecriptionE", "");
+                }
                 co.recStatus = v.second.get("RecStatus", "");
 
                 if (codeType == "_ALTERRELATION") {
@@ -345,14 +396,16 @@ void parseXML(const std::string &filename,
                 dos.maxDailyDoseUnitRef1 = v.second.get("MaxDailyDoseReferenceUnit1", "");
                 dos.maxDailyDoseUnitRef2 = v.second.get("MaxDailyDoseReferenceUnit2", "");
 
-                if (language == "de")
-                    dos.remarks = v.second.get("RemarksD", "");
-                else if (language == "fr")
-                    dos.remarks = v.second.get("RemarksF", "");
-                else if (language == "it")
-                    dos.remarks = v.second.get("RemarksI", "");
-                else //if (language == "en")
-                    dos.remarks = v.second.get("RemarksE", "");
+                for (auto language : languages) {
+                    if (language == "de")
+                        dos.remarks[language] = v.second.get("RemarksD", "");
+                    else if (language == "fr")
+                        dos.remarks[language] = v.second.get("RemarksF", "");
+                    else if (language == "it")
+                        dos.remarks[language] = v.second.get("RemarksI", "");
+                    else //if (language == "en")
+                        dos.remarks[language] = v.second.get("RemarksE", "");
+                }
 
                 dos.roaCode = v.second.get("ROACode", "");
                 dos.caseId = v.second.get("CaseID", "");
@@ -369,53 +422,68 @@ void parseXML(const std::string &filename,
         << std::endl;
     }
 
+    buildIndexes();
     printFileStats(filename);
 }
     
-std::string getDescriptionByAtc(const std::string &atc)
+std::string getDescriptionByAtc(const std::string &atc,
+                                const std::string &language)
 {
-    return codeAtcMap[atc].description;
+    return getCodeDescription(codeAtcMap, atc, language);
 }
 
 // The input string is in the format "atccode[,atccode]*"
-std::string getTextByAtcs(const std::string atcs)
+std::string getTextByAtcs(const std::string atcs,
+                          const std::string &language)
 {
     std::string text;
     std::string firstAtc = ATC::getFirstAtc(atcs);
     
-    return codeAtcMap[firstAtc].description;
+    return getCodeDescription(codeAtcMap, firstAtc, language);
 }
 
 // There could be multiple cases for the same ATC. Return a vector
-void getCasesByAtc(const std::string &atc, std::vector<_case> &cases)
+CaseList getCasesByAtc(const std::string &atc)
 {
-    for (auto c : caseVec) {
-        if (c.atcCode == atc)
-            cases.push_back(c);
-    }
+    CaseList cases;
+    auto range = atcCaseMap.equal_range(atc);
+    for (auto it = range.first; it != range.second; ++it)
+        cases.push_back(std::cref(caseVec[it->second]));
+
+    return cases;
 }
     
-std::string getIndicationByKey(const std::string &key)
+std::string getIndicationByKey(const std::string &key,
+                               const std::string &language)
 {
-    return indicationMap[key].name;
+    auto search = indicationMap.find(key);
+    if (search == indicationMap.end())
+        return {};
+
+    return LOC::get(search->second.name, language);
 }
 
-//_dosage getDosageById(const std::string &id)
-void getDosageById(const std::string &id, std::vector<_dosage> &dosages)
+DosageRange getDosageById(const std::string &id)
 {
-    for (auto d : dosageVec)
-        if (d.caseId == id)
-            dosages.push_back(d);
+    DosageRange dosages;
+    auto search = caseDosageMap.find(id);
+    if (search != caseDosageMap.end()) {
+        dosages.first = dosageVec.data() + search->second.first;
+        dosages.last = dosageVec.data() + search->second.second;
+    }
+
+    return dosages;
 }
 
 // Each "case" generates one table
 // One ATC can have mnay cases and therefore multiple tables
 //
-std::string getHtmlByAtc(const std::string atc)
+std::string getHtmlByAtc(const std::string atc,
+                         const std::string &language)
 {
+    const std::map<std::string, std::string> &th = thTitleMap.at(language);
     std::string html;
-    std::vector<_case> cases;
-    PED::getCasesByAtc(atc, cases);
+    CaseList cases = PED::getCasesByAtc(atc);
     
     if (cases.empty()) {
         statsCasesForAtcNotFoundCount++;
@@ -426,11 +494,10 @@ std::string getHtmlByAtc(const std::string atc)
 
     html.clear();
 
-    for (auto ca : cases) {
-        auto description = PED::getDescriptionByAtc(atc);
-        auto indication = PED::getIndicationByKey(ca.indicationKey);
-        std::vector<_dosage> dosages;
-        PED::getDosageById(ca.caseId, dosages);
+    for (const _case &ca : cases) {
+        auto description = PED::getDescriptionByAtc(atc, language);
+        auto indication = PED::getIndicationByKey(ca.indicationKey, language);
+        DosageRange dosages = PED::getDosageById(ca.caseId);
         
         // Check for optional columns
         std::map<std::string, bool> optionalColumnMap = {
@@ -442,7 +509,7 @@ std::string getHtmlByAtc(const std::string atc)
             {TH_KEY_REM, false}
         };
         int numColumns = th_key.size() - optionalColumnMap.size();
-        for (auto dosage : dosages) {
+        for (const _dosage &dosage : dosages) {
             if (!optionalColumnMap[TH_KEY_ROA] &&
                 (dosage.roaCode != ca.RoaCode))
             {
@@ -458,7 +525,7 @@ std::string getHtmlByAtc(const std::string atc)
             }
 
             if (!optionalColumnMap[TH_KEY_REM] &&
-                !dosage.remarks.empty())
+                !LOC::get(dosage.remarks, language).empty())
             {
                 optionalColumnMap[TH_KEY_REM] = true;
                 numColumns++;
@@ -492,12 +559,12 @@ std::string getHtmlByAtc(const std::string atc)
         // Start defining the HTML code
         std::string textBeforeTable;
         {
-            textBeforeTable = description + " (" + ca.RoaCode + ") " + codeRoaMap[ca.RoaCode].description + "<br />\n";
+            textBeforeTable = description + " (" + ca.RoaCode + ") " + getCodeDescription(codeRoaMap, ca.RoaCode, language) + "<br />\n";
             textBeforeTable += "ATC-Code: " + atc + "<br />\n";
-            textBeforeTable += indicationTitle + ": " + indication;
+            textBeforeTable += LOC::get(indicationTitle, language) + ": " + indication;
 
-            if (!optionalColumnMap[TH_KEY_TYPE] && !dosages[0].type.empty())
-                textBeforeTable += "<br />\n" + thTitleMap[TH_KEY_TYPE] + ": " + dosages[0].type;
+            if (!optionalColumnMap[TH_KEY_TYPE] && !dosages.empty() && !dosages[0].type.empty())
+                textBeforeTable += "<br />\n" + th.at(TH_KEY_TYPE) + ": " + dosages[0].type;
         }
         html += "\n<p class=\"spacing1\">" + textBeforeTable + "</p>\n";
 
@@ -511,27 +578,27 @@ std::string getHtmlByAtc(const std::string atc)
         tableBody.clear();
         
         if (dosages.size() > 0) {
-            tableHeader += TAG_TH_L + thTitleMap[TH_KEY_AGE] + TAG_TH_R;
+            tableHeader += TAG_TH_L + th.at(TH_KEY_AGE) + TAG_TH_R;
             
             if (optionalColumnMap[TH_KEY_WEIGHT])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_WEIGHT] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_WEIGHT) + TAG_TH_R;
 
             if (optionalColumnMap[TH_KEY_TYPE])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_TYPE] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_TYPE) + TAG_TH_R;
 
-            tableHeader += TAG_TH_L + thTitleMap[TH_KEY_DOSE] + TAG_TH_R;
+            tableHeader += TAG_TH_L + th.at(TH_KEY_DOSE) + TAG_TH_R;
             
             if (optionalColumnMap[TH_KEY_REPEAT])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_REPEAT] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_REPEAT) + TAG_TH_R;
 
             if (optionalColumnMap[TH_KEY_ROA])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_ROA] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_ROA) + TAG_TH_R;
 
             if (optionalColumnMap[TH_KEY_MAX])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_MAX] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_MAX) + TAG_TH_R;
 
             if (optionalColumnMap[TH_KEY_REM])
-                tableHeader += TAG_TH_L + thTitleMap[TH_KEY_REM] + TAG_TH_R;
+                tableHeader += TAG_TH_L + th.at(TH_KEY_REM) + TAG_TH_R;
 
             tableHeader += "\n"; // for readability
 
@@ -543,15 +610,15 @@ std::string getHtmlByAtc(const std::string atc)
 #endif
         } // if dosages.size()
 
-        for (auto dosage : dosages) {
+        for (const _dosage &dosage : dosages) {
             std::string tableRow;
             tableRow += TAG_TD_L;
             tableRow += dosage.ageFrom;
-            tableRow += " " + codeZeitMap[dosage.ageFromUnit].description;
+            tableRow += " " + getCodeDescription(codeZeitMap, dosage.ageFromUnit, language);
             tableRow += " - " + dosage.ageTo;
-            tableRow += " " + codeZeitMap[dosage.ageToUnit].description;
+            tableRow += " " + getCodeDescription(codeZeitMap, dosage.ageToUnit, language);
             if (!dosage.ageWeightRelation.empty())
-                tableRow += " " + codeAlterMap[dosage.ageWeightRelation].description;
+                tableRow += " " + getCodeDescription(codeAlterMap, dosage.ageWeightRelation, language);
             tableRow += TAG_TD_R;
 
             if (optionalColumnMap[TH_KEY_WEIGHT]) {
@@ -573,11 +640,11 @@ std::string getHtmlByAtc(const std::string atc)
             tableRow += dosage.doseLow;
             if (dosage.doseLow != dosage.doseHigh)
                 tableRow += " - " + dosage.doseHigh;
-            tableRow += " " + getAbbreviation(dosage.doseUnit);
+            tableRow += " " + getAbbreviation(dosage.doseUnit, language);
             if (!dosage.doseUnitRef1.empty())
-                tableRow += "/" + getAbbreviation(dosage.doseUnitRef1);
+                tableRow += "/" + getAbbreviation(dosage.doseUnitRef1, language);
             if (!dosage.doseUnitRef2.empty())
-                tableRow += "/" + getAbbreviation(dosage.doseUnitRef2);
+                tableRow += "/" + getAbbreviation(dosage.doseUnitRef2, language);
             tableRow += TAG_TD_R;
 
             if (optionalColumnMap[TH_KEY_REPEAT]) {
@@ -596,17 +663,17 @@ std::string getHtmlByAtc(const std::string atc)
 
             if (optionalColumnMap[TH_KEY_MAX]) {
                 tableRow += TAG_TD_L;
-                tableRow += dosage.maxDailyDose + " " + getAbbreviation(dosage.maxDailyDoseUnit);
+                tableRow += dosage.maxDailyDose + " " + getAbbreviation(dosage.maxDailyDoseUnit, language);
                 if (!dosage.maxDailyDoseUnitRef1.empty())
-                    tableRow += "/" + getAbbreviation(dosage.maxDailyDoseUnitRef1);
+                    tableRow += "/" + getAbbreviation(dosage.maxDailyDoseUnitRef1, language);
                 if (!dosage.maxDailyDoseUnitRef2.empty())
-                    tableRow += "/" + getAbbreviation(dosage.maxDailyDoseUnitRef2);
+                    tableRow += "/" + getAbbreviation(dosage.maxDailyDoseUnitRef2, language);
                 tableRow += TAG_TD_R;
             }
 
             if (optionalColumnMap[TH_KEY_REM]) {
                 tableRow += TAG_TD_L;
-                tableRow += dosage.remarks;
+                tableRow += LOC::get(dosage.remarks, language);
                 tableRow += TAG_TD_R;
             }
 
@@ -632,10 +699,10 @@ std::string getHtmlByAtc(const std::string atc)
     return html;
 }
 
-void showPedDoseByAtc(const std::string atc)
+void showPedDoseByAtc(const std::string atc,
+                      const std::string &language)
 {
-    std::vector<_case> cases;
-    PED::getCasesByAtc(atc, cases);
+    CaseList cases = PED::getCasesByAtc(atc);
     
     if (cases.empty()) {
         std::cout << "No cases for ATC: " << atc << std::endl;
@@ -644,12 +711,11 @@ void showPedDoseByAtc(const std::string atc)
 
     std::cout << "Ped Dose, ATC: " << atc << std::endl;
 
-    for (auto ca : cases) {
-        auto description = PED::getDescriptionByAtc(atc);
-        auto indication = PED::getIndicationByKey(ca.indicationKey);
+    for (const _case &ca : cases) {
+        auto description = PED::getDescriptionByAtc(atc, language);
+        auto indication = PED::getIndicationByKey(ca.indicationKey, language);
         
-        std::vector<_dosage> dosages;
-        PED::getDosageById(ca.caseId, dosages);
+        DosageRange dosages = PED::getDosageById(ca.caseId);
         
         std::cout
         << "\t caseId: " << ca.caseId
@@ -657,7 +723,7 @@ void showPedDoseByAtc(const std::string atc)
         << "\n\t\t indication: " << indication
         << std::endl;
 
-        for (auto dosage : dosages) {
+        for (const _dosage &dosage : dosages) {
             std::cout
             << "\t\t dosage recommendation: " << dosage.key
             << "\n\t\t\t age: " << dosage.ageFrom << " " << dosage.ageFromUnit
@@ -671,8 +737,8 @@ void showPedDoseByAtc(const std::string atc)
             
             << "\n\t\t\t max daily dose: " << dosage.maxDailyDose << " " << dosage.maxDailyDoseUnit << "/" << dosage.maxDailyDoseUnitRef1 << "/" << dosage.maxDailyDoseUnitRef2;
 
-            if (!dosage.remarks.empty())
-                std::cout << "\n\t\t\t remarks: " << dosage.remarks;
+            if (!LOC::get(dosage.remarks, language).empty())
+                std::cout << "\n\t\t\t remarks: " << LOC::get(dosage.remarks, language);
 
             std::cout << std::endl;
         }
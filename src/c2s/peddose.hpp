@@ -10,6 +10,9 @@
 #ifndef peddose_hpp
 #define peddose_hpp
 
+#include <functional>
+#include "localized.hpp"
+
 namespace PED
 {
     struct _case {
@@ -20,13 +23,13 @@ namespace PED
     };
     
     struct _indication {
-        std::string name;
+        LOC::Text name;
         std::string recStatus;
     };
     
     struct _code {
         std::string value;
-        std::string description;
+        LOC::Text description;
         std::string recStatus;
     };
 
@@ -64,26 +67,45 @@ namespace PED
         std::string maxDailyDoseUnitRef2;
 
         std::string roaCode;
-        std::string remarks;
+        LOC::Text remarks;
 
         std::string caseId;
         std::string type;
     };
     
+    typedef std::vector<std::reference_wrapper<const _case>> CaseList;
+
+    // The dosages of one case, adjacent in dosageVec
+    struct DosageRange {
+        const _dosage *first = nullptr;
+        const _dosage *last = nullptr;
+
+        const _dosage * begin() const { return first; }
+        const _dosage * end() const { return last; }
+        size_t size() const { return last - first; }
+        bool empty() const { return first == last; }
+        const _dosage & operator[](size_t i) const { return first[i]; }
+    };
+
     void parseXML(const std::string &filename,
-                  const std::string &language);
+                  const std::vector<std::string> &languages);
 
-    std::string getTextByAtcs(const std::string atcs);
-    void getCasesByAtc(const std::string &atc, std::vector<_case> &cases);
-    std::string getDescriptionByAtc(const std::string &atc);
-    std::string getIndicationByKey(const std::string &key);
+    std::string getTextByAtcs(const std::string atcs,
+                              const std::string &language);
+    CaseList getCasesByAtc(const std::string &atc);
+    std::string getDescriptionByAtc(const std::string &atc,
+                                    const std::string &language);
+    std::string getIndicationByKey(const std::string &key,
+                                   const std::string &language);
 
-    void getDosageById(const std::string &id, std::vector<_dosage> &dosages);
+    DosageRange getDosageById(const std::string &id);
     
     //std::string getRoaDescription(const std::string &codeValue);
     
-    std::string getHtmlByAtc(const std::string atc);
-    void showPedDoseByAtc(const std::string atc);
+    std::string getHtmlByAtc(const std::string atc,
+                             const std::string &language);
+    void showPedDoseByAtc(const std::string atc,
+                          const std::string &language);
     
     void printUsageStats();
 }
@@ -8,6 +8,9 @@
 //
 
 #include <set>
+#include <map>
+#include <unordered_map>
+#include <atomic>
 #include <libgen.h>     // for basename()
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -20,17 +23,22 @@
 #include "swissmedic.hpp"
 #include "beautify.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 namespace pt = boost::property_tree;
 
 namespace REFDATA
 {
     ArticleList artList;
+
+    // Built by parseXML(), read-only afterwards
+    std::multimap<std::string, size_t> gtin5Map;        // articles of a regnr, in file order
+    std::unordered_map<std::string, size_t> gtinMap;    // first article with the GTIN
     
     unsigned int statsArticleChildCount = 0;
     unsigned int statsItemCount = 0;
 
-    unsigned int statsTotalGtinCount = 0;
+    std::atomic<unsigned int> statsTotalGtinCount{0};
 
 static
 void printFileStats(const std::string &filename)
@@ -55,15 +63,26 @@ void printUsageStats()
     REP::html_end_ul();
 }
 
+// nullptr if there is no article with the GTIN
+static const Article * findArticle(const std::string &gtin)
+{
+    auto search = gtinMap.find(gtin);
+    if (search == gtinMap.end())
+        return nullptr;
+
+    return &artList[search->second];
+}
+
 void parseXML(const std::string &filename,
-              const std::string &language)
+              const std::vector<std::string> &languages)
 {
     pt::ptree tree;
-    const std::string nameTag = "NAME_" + boost::to_upper_copy( language );
 
     try {
         std::clog << std::endl << "Reading refdata XML" << std::endl;
-        pt::read_xml(filename, tree);
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        pt::read_xml(stream, tree);
     }
     catch (std::exception &e) {
         std::cerr << "Line: " << __LINE__ << " Error " << e.what() << std::endl;
@@ -95,10 +114,15 @@ void parseXML(const std::string &filename,
                 article.gtin_13 = gtin;
                 article.gtin_5 = gtin.substr(4,5); // pos, len
                 article.phar = v.second.get<std::string>("PHAR", "");
-                article.name = v.second.get<std::string>(nameTag, "");
-                BEAUTY::beautifyName(article.name);
-
-                artList.push_back(article);
+                for (auto language : languages) {
+                    std::string name = v.second.get<std::string>("NAME_" + boost::to_upper_copy(language), "");
+                    BEAUTY::beautifyName(name);
+                    article.name[language] = name;
+                }
+
+                gtin5Map.emplace(article.gtin_5, artList.size());
+                gtinMap.emplace(article.gtin_13, artList.size());
+                artList.push_back(std::move(article));
             }
 //            else {
 //                // one "<xmlattr>" and one "RESULT"
@@ -119,55 +143,71 @@ void parseXML(const std::string &filename,
 // Return count added
 int getNames(const std::string &rn,
              std::set<std::string> &gtinUsed,
-             GTIN::oneFachinfoPackages &packages)
+             GTIN::oneFachinfoPackages &packages,
+             const std::string &language)
 {
     int countAdded = 0;
 
-    for (Article art : artList) {
-        if (art.gtin_5 == rn) {
-            countAdded++;
-            statsTotalGtinCount++;
-            
-            std::string onePackageInfo;
+    auto range = gtin5Map.equal_range(rn);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Article &art = artList[it->second];
+        countAdded++;
+        statsTotalGtinCount++;
+        
+        std::string onePackageInfo;
 #ifdef DEBUG_IDENTIFY_NAMES
-            onePackageInfo += "ref+";
+        onePackageInfo += "ref+";
 #endif
-            onePackageInfo += art.name;
+        onePackageInfo += LOC::get(art.name, language);
 
-            std::string cat = SWISSMEDIC::getCategoryByGtin(art.gtin_13);
-            std::string paf = BAG::getPricesAndFlags(art.gtin_13, "", cat);
-            if (!paf.empty())
-                onePackageInfo += paf;
+        std::string cat = SWISSMEDIC::getCategoryByGtin(art.gtin_13);
+        std::string paf = BAG::getPricesAndFlags(art.gtin_13, "", cat);
+        if (!paf.empty())
+            onePackageInfo += paf;
 
-            gtinUsed.insert(art.gtin_13);
-            packages.gtin.push_back(art.gtin_13);
-            packages.name.push_back(onePackageInfo);
-        }
+        gtinUsed.insert(art.gtin_13);
+        packages.gtin.push_back(art.gtin_13);
+        packages.name.push_back(onePackageInfo);
+        packages.category.push_back(cat);
     }
     
     return countAdded;
 }
     
-bool findGtin(const std::string &gtin)
+// All the articles, for productdb
+// Those already in gtinUsed are skipped. Usage stats are not affected
+void getProducts(std::set<std::string> &gtinUsed,
+                 GTIN::products &products,
+                 const std::string &language)
 {
-    for (Article art : artList)
-        if (art.gtin_13 == gtin)
-            return true;
-
-    return false;
+    for (const Article &art : artList) {
+        if (gtinUsed.find(art.gtin_13) != gtinUsed.end())
+            continue;
+
+        std::string cat = SWISSMEDIC::getCategoryByGtin(art.gtin_13);
+        std::string paf = BAG::getPricesAndFlags(art.gtin_13, "", cat);
+
+        gtinUsed.insert(art.gtin_13);
+        products.gtin.push_back(art.gtin_13);
+        const std::string &name = LOC::get(art.name, language);
+        products.name.push_back(name);
+        products.packInfo.push_back(name + paf);
+        products.author.push_back("");
+        products.category.push_back(cat);
+    }
 }
 
-std::string getPharByGtin(const std::string &gtin)
+bool findGtin(const std::string &gtin)
 {
-    std::string phar;
+    return gtinMap.find(gtin) != gtinMap.end();
+}
 
-    for (Article art : artList)
-        if (art.gtin_13 == gtin) {
-            phar = art.phar;
-            break;
-        }
-    
-    return phar;
+// Empty if not found
+const std::string & getPharByGtin(const std::string &gtin)
+{
+    static const std::string empty;
+    const Article *art = findArticle(gtin);
+    return art ? art->phar : empty;
 }
 
 }
@@ -15,6 +15,7 @@
 
 #include "medicine.h"
 #include "gtin.hpp"
+#include "localized.hpp"
 
 namespace REFDATA
 {
@@ -22,21 +23,26 @@ namespace REFDATA
         std::string gtin_13;
         std::string gtin_5;
         std::string phar;
-        std::string name;
+        LOC::Text name;
     };
     
     typedef std::vector<Article> ArticleList;
     
     void parseXML(const std::string &filename,
-                  const std::string &language);
+                  const std::vector<std::string> &languages);
 
     int getNames(const std::string &rn,
                  std::set<std::string> &gtinUsed,
-                 GTIN::oneFachinfoPackages &packages);
+                 GTIN::oneFachinfoPackages &packages,
+                 const std::string &language);
+
+    void getProducts(std::set<std::string> &gtinUsed,
+                     GTIN::products &products,
+                     const std::string &language);
 
     bool findGtin(const std::string &gtin);
 
-    std::string getPharByGtin(const std::string &gtin);
+    const std::string & getPharByGtin(const std::string &gtin);
 
     void printUsageStats();
 }
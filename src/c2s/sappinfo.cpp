@@ -11,7 +11,11 @@
 #include <string>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
 #include <libgen.h>     // for basename()
 #include <boost/algorithm/string.hpp>
 
@@ -19,6 +23,7 @@
 
 #include "sappinfo.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 #include "html_tags.h"
 
 #define COLUMN_B        1   // Hauptindikation
@@ -56,13 +61,14 @@ namespace SAPP
     std::set<std::string> statsUniqueAtcSet;
 
     // Usage stats
-    unsigned int statsBfByAtcFoundCount = 0;
-    unsigned int statsBfByAtcNotFoundCount = 0;
-    unsigned int statsPregnByAtcFoundCount = 0;
-    unsigned int statsPregnByAtcNotFoundCount = 0;
-    unsigned int statsTablesCount[2] = {0,0};
+    std::atomic<unsigned int> statsBfByAtcFoundCount{0};
+    std::atomic<unsigned int> statsBfByAtcNotFoundCount{0};
+    std::atomic<unsigned int> statsPregnByAtcFoundCount{0};
+    std::atomic<unsigned int> statsPregnByAtcNotFoundCount{0};
+    std::atomic<unsigned int> statsTablesCount[2] = {{0},{0}};
     unsigned int statsRepeatedAtcCount = 0;         // Issue #70
     std::set<std::string> statsUniqueUsedAtcSet;    // Issue #70
+    std::mutex statsMutex;
 #ifdef SAPPINFO_NEW_STATS
     std::set<std::string> statsUniqueAtcSheet1Set;  // Issue #70
     std::set<std::string> statsUniqueAtcSheet2Set;  // Issue #70
@@ -72,8 +78,18 @@ namespace SAPP
     std::vector< std::vector<std::string> > sheetBreastFeeding;
     std::vector< std::vector<std::string> > sheetPregnancy;
     
-    std::vector<_breastfeed> breastFeedVec;
-    std::vector<_pregnancy> pregnancyVec;
+    // key is language
+    std::map<std::string, std::vector<_breastfeed>> breastFeedMap;
+    std::map<std::string, std::vector<_pregnancy>> pregnancyMap;
+
+    // Built by parseXLXS(), read-only afterwards
+    // key is ATC, value is the rows with it, the same for all the languages
+    std::unordered_map<std::string, std::vector<size_t>> breastFeedAtcMap;
+    std::unordered_map<std::string, std::vector<size_t>> pregnancyAtcMap;
+
+    // key is language, value is the HTML of each row
+    std::map<std::string, std::vector<std::string>> breastFeedHtmlMap;
+    std::map<std::string, std::vector<std::string>> pregnancyHtmlMap;
     
     const std::unordered_set<int> acceptedFiltersSet = { 1, 5, 6, 9 };
     
@@ -159,10 +175,11 @@ namespace SAPP
         "Type of use", "Active Substance", "Main Indication", "Indication",
         "breastfeeding", "pregnancy"
     };
-    std::map<std::string, std::string> localizedResourcesMap;
+    // key is language
+    std::map<std::string, std::map<std::string, std::string>> localizedResourcesMap;
 
-    // Used when language != "de"
-    std::map<std::string, std::string> deeplTranslatedMap;
+    // Used when language != "de", key is language
+    std::map<std::string, std::map<std::string, std::string>> deeplTranslatedMap;
 
     ////////////////////////////////////////////////////////////////////////////
 
@@ -170,7 +187,7 @@ namespace SAPP
     const std::vector<std::string> requiredColumnVec = {
         LOC_KEY_TH_TYPE, LOC_KEY_TH_MAX_DAILY
     };
-    std::map<std::string, bool> optionalColumnMap = {
+    const std::map<std::string, bool> optionalColumnMap = {
         {LOC_KEY_TH_COMMENT, false},
         {LOC_KEY_TH_APPROVAL, false}
     };
@@ -179,7 +196,7 @@ namespace SAPP
     const std::vector<std::string> requiredColumnVec_2 = {
         LOC_KEY_TH_TYPE
     };
-    std::map<std::string, bool> optionalColumnMap_2 = {
+    const std::map<std::string, bool> optionalColumnMap_2 = {
         {LOC_KEY_TH_COMMENT, false},
         {LOC_KEY_TH_MAX1, false},
         {LOC_KEY_TH_MAX2, false},
@@ -188,8 +205,7 @@ namespace SAPP
         {LOC_KEY_TH_PERIDOSE_COMMENT, false}
     };
     
-    static void getBreastFeedByAtc(const std::string &atc, std::vector<_breastfeed> &bfv);
-    static void getPregnancyByAtc(const std::string &atc, std::vector<_pregnancy> &pv);
+    static void buildHtml(const std::vector<std::string> &languages);
     static void printFileStats(const std::string &filename);
 
 static void printFileStats(const std::string &filename)
@@ -270,13 +286,22 @@ std::string getLocalized(const std::string &language,
     if (s == "-")
         return {};
 
+    // Read only, it's called by more than one thread
+    std::string translation;
+    auto language_it = deeplTranslatedMap.find(language);
+    if (language_it != deeplTranslatedMap.end()) {
+        auto it = language_it->second.find(s);
+        if (it != language_it->second.end())
+            translation = it->second;
+    }
+
 #ifdef DEBUG
-    if (deeplTranslatedMap[s].empty())
+    if (translation.empty())
         std::clog << "Empty translation for <" << s << ">" << std::endl;
 
-    assert(!deeplTranslatedMap[s].empty());
+    assert(!translation.empty());
 #endif
-    return deeplTranslatedMap[s];
+    return translation;
 }
 
 // Define deeplTranslatedMap
@@ -321,47 +346,12 @@ void getDeeplTranslationMap(const std::string &dir,
     }
 }
     
-// TODO: use a set of ATCs to speed up the lookup
-void parseXLXS(const std::string &inDir,
-               const std::string &inFile,
-               const std::string &language)
+// Each sheet fills its own globals and atcSet, so that both sheets
+// can be read at the same time
+static void parseBreastFeedingSheet(xlnt::worksheet ws,
+                                    const std::vector<std::string> &languages,
+                                    std::set<std::string> &atcSet)
 {
-#ifdef DEBUG
-    assert(loc_string_key.size == loc_string_de.size);
-    assert(loc_string_key.size == loc_string_fr.size);
-    assert(loc_string_key.size == loc_string_en.size);
-#endif
-    //const std::unordered_set<int> acceptedFiltersSet = { 1, 5, 6, 9 };
-
-    {
-        // Define localized strings
-        std::vector<std::string> &loc_string = loc_string_en;
-
-        if (language == "de") {
-            loc_string = loc_string_de;
-        }
-        else if (language == "fr") {
-            loc_string = loc_string_fr;
-        }
-
-        // Create localization map for string resources NOT from the input file
-        for (int i=0; i< loc_string_key.size(); i++)
-            localizedResourcesMap.insert(std::make_pair(loc_string_key[i], loc_string[i]));
-
-        // Create localization map for string resources from the input file (translated with DeepL)
-        if (language != "de")
-            getDeeplTranslationMap(inDir, "sappinfo", language, deeplTranslatedMap);
-    }
-
-    const std::string &filename = inDir + inFile;
-    xlnt::workbook wb;
-    wb.load(filename);
-    //auto ws = wb.active_sheet();
-
-    std::clog << std::endl << "Reading sappinfo XLSX" << std::endl;
-
-    // Breast-feeding sheet
-    auto ws = wb.sheet_by_index(0);
     sheetTitle[0] = ws.title();
     std::clog << "\tSheet: " << ws.title() << std::endl;
 
@@ -400,17 +390,19 @@ void parseXLXS(const std::string &inDir,
         boost::algorithm::split(bf.c.atcCodeVec, bf.c.atcCodes, boost::is_any_of(ATC_LIST_SEPARATOR), boost::token_compress_on);
 
         for (auto a : bf.c.atcCodeVec)
-            statsUniqueAtcSet.insert(a);
+            atcSet.insert(a);
 #endif
-        bf.c.activeSubstance = getLocalized(language, aSingleRow[COLUMN_G]);
-        bf.c.mainIndication = getLocalized(language, aSingleRow[COLUMN_B]);
-        bf.c.indication = getLocalized(language, aSingleRow[COLUMN_C]);
-        bf.c.typeOfApplication = getLocalized(language, aSingleRow[COLUMN_H]);
         bf.c.link = aSingleRow[COLUMN_S]; if (bf.c.link == "nein") bf.c.link.clear();
-        bf.c.comments = getLocalized(language, aSingleRow[COLUMN_J]);
         bf.approval = aSingleRow[COLUMN_Q];
-        bf.maxDailyDose = getLocalized(language, aSingleRow[COLUMN_I]);
-        breastFeedVec.push_back(bf);
+        for (auto language : languages) {
+            bf.c.activeSubstance = getLocalized(language, aSingleRow[COLUMN_G]);
+            bf.c.mainIndication = getLocalized(language, aSingleRow[COLUMN_B]);
+            bf.c.indication = getLocalized(language, aSingleRow[COLUMN_C]);
+            bf.c.typeOfApplication = getLocalized(language, aSingleRow[COLUMN_H]);
+            bf.c.comments = getLocalized(language, aSingleRow[COLUMN_J]);
+            bf.maxDailyDose = getLocalized(language, aSingleRow[COLUMN_I]);
+            breastFeedMap[language].push_back(bf);
+        }
 #ifdef DEBUG_SAPPINFO
         if (aSingleRow[COLUMN_R] == "J02AC01") {
             std::clog
@@ -428,14 +420,16 @@ void parseXLXS(const std::string &inDir,
         }
 #endif
     }
-    
-    // Pregnancy sheet
-    
-    ws = wb.sheet_by_index(1);
+}
+
+static void parsePregnancySheet(xlnt::worksheet ws,
+                                const std::vector<std::string> &languages,
+                                std::set<std::string> &atcSet)
+{
     sheetTitle[1] = ws.title();
     std::clog << "\tSheet: " << ws.title() << std::endl;
     
-    skipHeaderCount = 0;
+    int skipHeaderCount = 0;
     for (auto row : ws.rows(false)) {
         if (++skipHeaderCount <= FIRST_DATA_ROW_INDEX) {
 #ifdef DEBUG_SAPPINFO
@@ -476,20 +470,22 @@ void parseXLXS(const std::string &inDir,
         boost::algorithm::split(pr.c.atcCodeVec, pr.c.atcCodes, boost::is_any_of(ATC_LIST_SEPARATOR), boost::token_compress_on);
         
         for (auto a : pr.c.atcCodeVec)
-            statsUniqueAtcSet.insert(a);
+            atcSet.insert(a);
 #endif
-        pr.c.activeSubstance = getLocalized(language, aSingleRow[COLUMN_2_G]);
-        pr.c.mainIndication = getLocalized(language, aSingleRow[COLUMN_2_B]);
-        pr.c.indication = getLocalized(language, aSingleRow[COLUMN_2_C]);
-        pr.c.typeOfApplication = getLocalized(language, aSingleRow[COLUMN_2_H]);
         pr.c.link = aSingleRow[COLUMN_2_AA]; if (pr.c.link == "nein") pr.c.link.clear();
-        pr.c.comments = getLocalized(language, aSingleRow[COLUMN_2_L]);
-        pr.max1 = getLocalized(language, aSingleRow[COLUMN_2_I]);
-        pr.max2 = getLocalized(language, aSingleRow[COLUMN_2_J]);
-        pr.max3 = getLocalized(language, aSingleRow[COLUMN_2_K]);
         pr.periDosi = aSingleRow[COLUMN_2_M];
-        pr.periBeme = getLocalized(language, aSingleRow[COLUMN_2_N]);
-        pregnancyVec.push_back(pr);
+        for (auto language : languages) {
+            pr.c.activeSubstance = getLocalized(language, aSingleRow[COLUMN_2_G]);
+            pr.c.mainIndication = getLocalized(language, aSingleRow[COLUMN_2_B]);
+            pr.c.indication = getLocalized(language, aSingleRow[COLUMN_2_C]);
+            pr.c.typeOfApplication = getLocalized(language, aSingleRow[COLUMN_2_H]);
+            pr.c.comments = getLocalized(language, aSingleRow[COLUMN_2_L]);
+            pr.max1 = getLocalized(language, aSingleRow[COLUMN_2_I]);
+            pr.max2 = getLocalized(language, aSingleRow[COLUMN_2_J]);
+            pr.max3 = getLocalized(language, aSingleRow[COLUMN_2_K]);
+            pr.periBeme = getLocalized(language, aSingleRow[COLUMN_2_N]);
+            pregnancyMap[language].push_back(pr);
+        }
 #ifdef DEBUG_SAPPINFO
         if (aSingleRow[COLUMN_2_Z] == "J01FA01")
         {
@@ -511,330 +507,414 @@ void parseXLXS(const std::string &inDir,
         }
 #endif
     }
-
-    printFileStats(filename);
 }
 
-// There could be multiple lines for the same ATC. Return a vector
-template <class T>
-void getByAtc(const std::string &atc,
-              const std::vector<T> &inVec,
-              std::vector<T> &outVec)
+void parseXLXS(const std::string &inDir,
+               const std::string &inFile,
+               const std::vector<std::string> &languages)
 {
-    for (auto item : inVec)
-        for (auto a : item.c.atcCodeVec)
-            if (a == atc) {
-                outVec.push_back(item);
-                
-                // Break out of the inner loop, to move onto the next item
-                // Not a big speed gain for only two items, but logically it makes sense
-                break;
-            }
-}
+#ifdef DEBUG
+    assert(loc_string_key.size == loc_string_de.size);
+    assert(loc_string_key.size == loc_string_fr.size);
+    assert(loc_string_key.size == loc_string_en.size);
+#endif
+    //const std::unordered_set<int> acceptedFiltersSet = { 1, 5, 6, 9 };
 
-static void getBreastFeedByAtc(const std::string &atc, std::vector<_breastfeed> &bfv)
-{
-    getByAtc<_breastfeed>(atc, breastFeedVec, bfv);
+    for (auto language : languages) {
+        // Define localized strings
+        const std::vector<std::string> *loc_string = &loc_string_en;
+
+        if (language == "de") {
+            loc_string = &loc_string_de;
+        }
+        else if (language == "fr") {
+            loc_string = &loc_string_fr;
+        }
+
+        // Create localization map for string resources NOT from the input file
+        for (int i=0; i< loc_string_key.size(); i++)
+            localizedResourcesMap[language].insert(std::make_pair(loc_string_key[i], (*loc_string)[i]));
+
+        // Create localization map for string resources from the input file (translated with DeepL)
+        if (language != "de")
+            getDeeplTranslationMap(inDir, "sappinfo", language, deeplTranslatedMap[language]);
+    }
+
+    const std::string &filename = inDir + inFile;
+    xlnt::workbook wb;
+    {
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        wb.load(stream);
+    }
+    //auto ws = wb.active_sheet();
+
+    std::clog << std::endl << "Reading sappinfo XLSX" << std::endl;
+
+    // The two sheets are independent, read the second one on another thread
+    std::set<std::string> atcSet[2];
+    std::thread pregnancyThread(parsePregnancySheet,
+                                wb.sheet_by_index(1),
+                                std::cref(languages),
+                                std::ref(atcSet[1]));
+    parseBreastFeedingSheet(wb.sheet_by_index(0), languages, atcSet[0]);
+    pregnancyThread.join();
+
+    for (auto &s : atcSet)
+        statsUniqueAtcSet.insert(s.begin(), s.end());
+
+    buildHtml(languages);
+    printFileStats(filename);
 }
-    
-static void getPregnancyByAtc(const std::string &atc, std::vector<_pregnancy> &pv)
+
+// There could be multiple lines for the same ATC, each line is listed once
+template <class T>
+void indexByAtc(const std::vector<T> &inVec,
+                std::unordered_map<std::string, std::vector<size_t>> &atcMap)
 {
-    getByAtc<_pregnancy>(atc, pregnancyVec, pv);
+    for (size_t i = 0; i < inVec.size(); i++)
+        for (auto &a : inVec[i].c.atcCodeVec) {
+            std::vector<size_t> &rows = atcMap[a];
+            if (rows.empty() || (rows.back() != i))
+                rows.push_back(i);
+        }
 }
 
-std::string getHtmlByAtc(const std::string atc)
+// One paragraph and table, for one row of the first sheet
+static std::string getBreastFeedHtml(const _breastfeed &b,
+                                     const std::map<std::string, std::string> &loc)
 {
-    //std::clog << basename((char *)__FILE__) << ":" << __LINE__ << " " << atc << std::endl;
-    
-    if (atc.empty())
-        return {};
-
-    // First check ordered set, quicker than going through the whole vector
-    if (statsUniqueAtcSet.find(atc) == statsUniqueAtcSet.end())
-        return {};
-    
-    // Issue #70
-    if (statsUniqueUsedAtcSet.find(atc) == statsUniqueAtcSet.end())
-        statsUniqueUsedAtcSet.insert(atc);
-    else
-        statsRepeatedAtcCount++;
-
-    std::string html;
-    html.clear();
+#if 1
+    // Check for optional columns
+    int numColumns = requiredColumnVec.size();
+    std::map<std::string, bool> optionalColumns = optionalColumnMap;  // all false
 
-    //---
-    std::vector<_breastfeed> bfv;
-    getBreastFeedByAtc(atc, bfv);
+    if (!optionalColumns[LOC_KEY_TH_COMMENT] &&
+        !b.c.comments.empty())
+    {
+        optionalColumns[LOC_KEY_TH_COMMENT] = true;
+        numColumns++;
+    }
 
-    if (bfv.empty()) {
-        statsBfByAtcNotFoundCount++;
+    if (!optionalColumns[LOC_KEY_TH_APPROVAL] &&
+        !b.approval.empty())
+    {
+        optionalColumns[LOC_KEY_TH_APPROVAL] = true;
+        numColumns++;
     }
-    else {
-        statsBfByAtcFoundCount++;
-#ifdef SAPPINFO_NEW_STATS
-        statsUniqueAtcSheet1Set.insert(atc);
 #endif
-    }
-    
-    for (auto b : bfv) {
-#if 1
-        // Check for optional columns
-        int numColumns = requiredColumnVec.size();
-        for (auto &m : optionalColumnMap)  // reset options
-            m.second = false;
 
-        if (!optionalColumnMap[LOC_KEY_TH_COMMENT] &&
-            !b.c.comments.empty())
-        {
-            optionalColumnMap[LOC_KEY_TH_COMMENT] = true;
-            numColumns++;
-        }
+    // Start defining the HTML code
+    std::string textBeforeTable;
+    {
+        textBeforeTable += loc.at(LOC_KEY_TYPE) + ": " + loc.at(LOC_KEY_SHEET1) + "<br />\n";
+        textBeforeTable += "ATC-Code: " + b.c.atcCodes + "<br />\n";
+        textBeforeTable += loc.at(LOC_KEY_ACT_SUBST) + ": " + b.c.activeSubstance + "<br />\n";
+        if (!b.c.mainIndication.empty())
+            textBeforeTable += loc.at(LOC_KEY_MAIN_INDIC) + ": " + b.c.mainIndication + "<br />\n";
 
-        if (!optionalColumnMap[LOC_KEY_TH_APPROVAL] &&
-            !b.approval.empty())
-        {
-            optionalColumnMap[LOC_KEY_TH_APPROVAL] = true;
-            numColumns++;
-        }
-#endif
+        if (!b.c.indication.empty())
+            textBeforeTable += loc.at(LOC_KEY_INDICATION) + ": " + b.c.indication + "<br />\n";
+        
+        if (!b.c.link.empty())
+            textBeforeTable += "<a href=\"" + b.c.link + "\">Sappinfo Monographie</a>" + "<br />\n"; // TODO: localize
+    }
+    std::string html = "\n<p class=\"spacing1\">" + textBeforeTable + "</p>\n";
 
-        // Start defining the HTML code
-        std::string textBeforeTable;
-        {
-            textBeforeTable += localizedResourcesMap[LOC_KEY_TYPE] + ": " + localizedResourcesMap[LOC_KEY_SHEET1] + "<br />\n";
-            textBeforeTable += "ATC-Code: " + b.c.atcCodes + "<br />\n";
-            textBeforeTable += localizedResourcesMap[LOC_KEY_ACT_SUBST] + ": " + b.c.activeSubstance + "<br />\n";
-            if (!b.c.mainIndication.empty())
-                textBeforeTable += localizedResourcesMap[LOC_KEY_MAIN_INDIC] + ": " + b.c.mainIndication + "<br />\n";
-
-            if (!b.c.indication.empty())
-                textBeforeTable += localizedResourcesMap[LOC_KEY_INDICATION] + ": " + b.c.indication + "<br />\n";
-            
-            if (!b.c.link.empty())
-                textBeforeTable += "<a href=\"" + b.c.link + "\">Sappinfo Monographie</a>" + "<br />\n"; // TODO: localize
-        }
-        html += "\n<p class=\"spacing1\">" + textBeforeTable + "</p>\n";
+    std::string tableColGroup(COL_SPAN_L + std::to_string(numColumns) + COL_SPAN_R);
+    tableColGroup = "<colgroup>" + tableColGroup + "</colgroup>";
+    
+    std::string tableHeader;
+    tableHeader.clear();
 
-        std::string tableColGroup(COL_SPAN_L + std::to_string(numColumns) + COL_SPAN_R);
-        tableColGroup = "<colgroup>" + tableColGroup + "</colgroup>";
-        
-        std::string tableHeader;
-        tableHeader.clear();
+    std::string tableBody;
+    tableBody.clear();
+    
+    {
+        tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_TYPE) + TAG_TH_R;        // col H
+        tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_MAX_DAILY) + TAG_TH_R;   // col I
 
-        std::string tableBody;
-        tableBody.clear();
+        if (optionalColumns[LOC_KEY_TH_COMMENT])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_COMMENT) + TAG_TH_R;  // col J
         
-        {
-            tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_TYPE] + TAG_TH_R;        // col H
-            tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_MAX_DAILY] + TAG_TH_R;   // col I
-
-            if (optionalColumnMap[LOC_KEY_TH_COMMENT])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_COMMENT] + TAG_TH_R;  // col J
-            
-            if (optionalColumnMap[LOC_KEY_TH_APPROVAL])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_APPROVAL] + TAG_TH_R; // col Q
-            
-            tableHeader += "\n"; // for readability
-            tableHeader = "<tr>" + tableHeader + "</tr>";
+        if (optionalColumns[LOC_KEY_TH_APPROVAL])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_APPROVAL) + TAG_TH_R; // col Q
+        
+        tableHeader += "\n"; // for readability
+        tableHeader = "<tr>" + tableHeader + "</tr>";
 #ifdef WITH_SEPARATE_TABLE_HEADER
-            tableHeader = "<thead>" + tableHeader + "</thead>";
+        tableHeader = "<thead>" + tableHeader + "</thead>";
 #else
-            tableBody += tableHeader;
+        tableBody += tableHeader;
 #endif
-        }
+    }
 
-        {
-            std::string tableRow;
+    {
+        std::string tableRow;
 
-            tableRow += TAG_TD_L + b.c.typeOfApplication + TAG_TD_R;
-            tableRow += TAG_TD_L + b.maxDailyDose + TAG_TD_R;
+        tableRow += TAG_TD_L + b.c.typeOfApplication + TAG_TD_R;
+        tableRow += TAG_TD_L + b.maxDailyDose + TAG_TD_R;
 
-            if (optionalColumnMap[LOC_KEY_TH_COMMENT])
-                tableRow += TAG_TD_L + b.c.comments + TAG_TD_R;
+        if (optionalColumns[LOC_KEY_TH_COMMENT])
+            tableRow += TAG_TD_L + b.c.comments + TAG_TD_R;
 
-            if (optionalColumnMap[LOC_KEY_TH_APPROVAL])
-                tableRow += TAG_TD_L + b.approval + TAG_TD_R;
+        if (optionalColumns[LOC_KEY_TH_APPROVAL])
+            tableRow += TAG_TD_L + b.approval + TAG_TD_R;
 
-            tableRow += "\n";  // for readability
-            tableRow = "<tr>" + tableRow + "</tr>";
-            tableBody += tableRow;
-        }
+        tableRow += "\n";  // for readability
+        tableRow = "<tr>" + tableRow + "</tr>";
+        tableBody += tableRow;
+    }
 
-        tableBody = "<tbody>" + tableBody + "</tbody>";
+    tableBody = "<tbody>" + tableBody + "</tbody>";
 
-        std::string table = tableColGroup;
+    std::string table = tableColGroup;
 #ifdef WITH_SEPARATE_TABLE_HEADER
-        table += tableHeader + tableBody;
+    table += tableHeader + tableBody;
 #else
-        table += tableBody;
+    table += tableBody;
 #endif
-        table = TAG_TABLE_L + table + TAG_TABLE_R;
-        html += table;
-
-        statsTablesCount[0]++;
-    }  // for bfv
-
-    //---
-    std::vector<_pregnancy> pregnv;
-    getPregnancyByAtc(atc, pregnv);
+    table = TAG_TABLE_L + table + TAG_TABLE_R;
+    html += table;
+    return html;
+}
 
-    if (pregnv.empty()) {
-        statsPregnByAtcNotFoundCount++;
-    }
-    else {
-        statsPregnByAtcFoundCount++;
-#ifdef SAPPINFO_NEW_STATS
-        statsUniqueAtcSheet2Set.insert(atc);
-#endif
-    }
-    
-    for (auto p : pregnv) {
+// One paragraph and table, for one row of the second sheet
+static std::string getPregnancyHtml(const _pregnancy &p,
+                                    const std::map<std::string, std::string> &loc)
+{
 #if 1
-        // Check for optional columns
-        int numColumns = requiredColumnVec_2.size();
-        for (auto &m : optionalColumnMap_2)  // reset options
-            m.second = false;
+    // Check for optional columns
+    int numColumns = requiredColumnVec_2.size();
+    std::map<std::string, bool> optionalColumns_2 = optionalColumnMap_2;  // all false
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_MAX1] &&
-            !p.max1.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_MAX1] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_MAX1] &&
+        !p.max1.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_MAX1] = true;
+        numColumns++;
+    }
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_MAX2] &&
-            !p.max2.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_MAX2] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_MAX2] &&
+        !p.max2.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_MAX2] = true;
+        numColumns++;
+    }
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_MAX3] &&
-            !p.max3.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_MAX3] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_MAX3] &&
+        !p.max3.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_MAX3] = true;
+        numColumns++;
+    }
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_COMMENT] &&
-            !p.c.comments.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_COMMENT] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_COMMENT] &&
+        !p.c.comments.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_COMMENT] = true;
+        numColumns++;
+    }
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_PERIDOSE] &&
-            !p.periDosi.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_PERIDOSE] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_PERIDOSE] &&
+        !p.periDosi.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_PERIDOSE] = true;
+        numColumns++;
+    }
 
-        if (!optionalColumnMap_2[LOC_KEY_TH_PERIDOSE_COMMENT] &&
-            !p.periBeme.empty())
-        {
-            optionalColumnMap_2[LOC_KEY_TH_PERIDOSE_COMMENT] = true;
-            numColumns++;
-        }
+    if (!optionalColumns_2[LOC_KEY_TH_PERIDOSE_COMMENT] &&
+        !p.periBeme.empty())
+    {
+        optionalColumns_2[LOC_KEY_TH_PERIDOSE_COMMENT] = true;
+        numColumns++;
+    }
 #endif
+    
+    // Define the HTML code
+    std::string textBeforeTable;
+    {
+        textBeforeTable += loc.at(LOC_KEY_TYPE) + ": " + loc.at(LOC_KEY_SHEET2) + "<br />\n";
+        textBeforeTable += "ATC-Code: " + p.c.atcCodes + "<br />\n";
+        textBeforeTable += loc.at(LOC_KEY_ACT_SUBST) + ": " + p.c.activeSubstance + "<br />\n";
+        if (!p.c.mainIndication.empty())
+            textBeforeTable += loc.at(LOC_KEY_MAIN_INDIC) + ": " + p.c.mainIndication + "<br />\n";
         
-        // Define the HTML code
-        std::string textBeforeTable;
-        {
-            textBeforeTable += localizedResourcesMap[LOC_KEY_TYPE] + ": " + localizedResourcesMap[LOC_KEY_SHEET2] + "<br />\n";
-            textBeforeTable += "ATC-Code: " + p.c.atcCodes + "<br />\n";
-            textBeforeTable += localizedResourcesMap[LOC_KEY_ACT_SUBST] + ": " + p.c.activeSubstance + "<br />\n";
-            if (!p.c.mainIndication.empty())
-                textBeforeTable += localizedResourcesMap[LOC_KEY_MAIN_INDIC] + ": " + p.c.mainIndication + "<br />\n";
-            
-            if (!p.c.indication.empty())
-                textBeforeTable += localizedResourcesMap[LOC_KEY_INDICATION] + ": " + p.c.indication + "<br />\n";
-            
-            if (!p.c.link.empty())
-                textBeforeTable += "<a href=\"" + p.c.link + "\">Sappinfo Monographie</a>" + "<br />\n"; // TODO: localize
-        }
-        html += "\n<p class=\"spacing1\">" + textBeforeTable + "</p>\n";
-        
-        std::string tableColGroup(COL_SPAN_L + std::to_string(numColumns) + COL_SPAN_R);
-        tableColGroup = "<colgroup>" + tableColGroup + "</colgroup>";
-        
-        std::string tableHeader;
-        tableHeader.clear();
-        
-        std::string tableBody;
-        tableBody.clear();
+        if (!p.c.indication.empty())
+            textBeforeTable += loc.at(LOC_KEY_INDICATION) + ": " + p.c.indication + "<br />\n";
         
-        {
-            tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_TYPE] + TAG_TH_R;
+        if (!p.c.link.empty())
+            textBeforeTable += "<a href=\"" + p.c.link + "\">Sappinfo Monographie</a>" + "<br />\n"; // TODO: localize
+    }
+    std::string html = "\n<p class=\"spacing1\">" + textBeforeTable + "</p>\n";
+    
+    std::string tableColGroup(COL_SPAN_L + std::to_string(numColumns) + COL_SPAN_R);
+    tableColGroup = "<colgroup>" + tableColGroup + "</colgroup>";
+    
+    std::string tableHeader;
+    tableHeader.clear();
+    
+    std::string tableBody;
+    tableBody.clear();
+    
+    {
+        tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_TYPE) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX1])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_MAX1] + TAG_TH_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX1])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_MAX1) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX2])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_MAX2] + TAG_TH_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX2])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_MAX2) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX3])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_MAX3] + TAG_TH_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX3])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_MAX3) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_COMMENT])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_COMMENT] + TAG_TH_R;
+        if (optionalColumns_2[LOC_KEY_TH_COMMENT])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_COMMENT) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_PERIDOSE])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_PERIDOSE] + TAG_TH_R;
+        if (optionalColumns_2[LOC_KEY_TH_PERIDOSE])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_PERIDOSE) + TAG_TH_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_PERIDOSE_COMMENT])
-                tableHeader += TAG_TH_L + localizedResourcesMap[LOC_KEY_TH_PERIDOSE_COMMENT] + TAG_TH_R;
-            
-            tableHeader += "\n"; // for readability
-            tableHeader = "<tr>" + tableHeader + "</tr>";
+        if (optionalColumns_2[LOC_KEY_TH_PERIDOSE_COMMENT])
+            tableHeader += TAG_TH_L + loc.at(LOC_KEY_TH_PERIDOSE_COMMENT) + TAG_TH_R;
+        
+        tableHeader += "\n"; // for readability
+        tableHeader = "<tr>" + tableHeader + "</tr>";
 #ifdef WITH_SEPARATE_TABLE_HEADER
-            tableHeader = "<thead>" + tableHeader + "</thead>";
+        tableHeader = "<thead>" + tableHeader + "</thead>";
 #else
-            tableBody += tableHeader;
+        tableBody += tableHeader;
 #endif
-        }
+    }
+    
+    {
+        std::string tableRow;
         
-        {
-            std::string tableRow;
-            
-            tableRow += TAG_TD_L + p.c.typeOfApplication + TAG_TD_R;
+        tableRow += TAG_TD_L + p.c.typeOfApplication + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX1])
-                tableRow += TAG_TD_L + p.max1 + TAG_TD_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX1])
+            tableRow += TAG_TD_L + p.max1 + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX2])
-                tableRow += TAG_TD_L + p.max2 + TAG_TD_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX2])
+            tableRow += TAG_TD_L + p.max2 + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_MAX3])
-                tableRow += TAG_TD_L + p.max3 + TAG_TD_R;
+        if (optionalColumns_2[LOC_KEY_TH_MAX3])
+            tableRow += TAG_TD_L + p.max3 + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_COMMENT])
-                tableRow += TAG_TD_L + p.c.comments + TAG_TD_R;
+        if (optionalColumns_2[LOC_KEY_TH_COMMENT])
+            tableRow += TAG_TD_L + p.c.comments + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_PERIDOSE])
-                tableRow += TAG_TD_L + p.periDosi + TAG_TD_R;
+        if (optionalColumns_2[LOC_KEY_TH_PERIDOSE])
+            tableRow += TAG_TD_L + p.periDosi + TAG_TD_R;
 
-            if (optionalColumnMap_2[LOC_KEY_TH_PERIDOSE_COMMENT])
-                tableRow += TAG_TD_L + p.periBeme + TAG_TD_R;
-            
-            tableRow += "\n";  // for readability
-            tableRow = "<tr>" + tableRow + "</tr>";
-            tableBody += tableRow;
-        }
-        
-        tableBody = "<tbody>" + tableBody + "</tbody>";
+        if (optionalColumns_2[LOC_KEY_TH_PERIDOSE_COMMENT])
+            tableRow += TAG_TD_L + p.periBeme + TAG_TD_R;
         
-        std::string table = tableColGroup;
+        tableRow += "\n";  // for readability
+        tableRow = "<tr>" + tableRow + "</tr>";
+        tableBody += tableRow;
+    }
+    
+    tableBody = "<tbody>" + tableBody + "</tbody>";
+    
+    std::string table = tableColGroup;
 #ifdef WITH_SEPARATE_TABLE_HEADER
-        table += tableHeader + tableBody;
+    table += tableHeader + tableBody;
 #else
-        table += tableBody;
+    table += tableBody;
 #endif
-        table = TAG_TABLE_L + table + TAG_TABLE_R;
-        html += table;
-        
-        statsTablesCount[1]++;
-    } // for pregnv
+    table = TAG_TABLE_L + table + TAG_TABLE_R;
+    html += table;
+    return html;
+}
+
+// Each row becomes the same HTML for every monograph with one of its ATCs,
+// so it's created once here, for each language
+static void buildHtml(const std::vector<std::string> &languages)
+{
+    if (languages.empty())
+        return;
+
+    // The rows are in the same order for all the languages
+    const std::string &firstLanguage = languages[0];
+    indexByAtc<_breastfeed>(breastFeedMap[firstLanguage], breastFeedAtcMap);
+    indexByAtc<_pregnancy>(pregnancyMap[firstLanguage], pregnancyAtcMap);
+
+    for (auto language : languages) {
+        const std::map<std::string, std::string> &loc = localizedResourcesMap.at(language);
+
+        for (auto &b : breastFeedMap[language])
+            breastFeedHtmlMap[language].push_back(getBreastFeedHtml(b, loc));
+
+        for (auto &p : pregnancyMap[language])
+            pregnancyHtmlMap[language].push_back(getPregnancyHtml(p, loc));
+    }
+}
+
+std::string getHtmlByAtc(const std::string atc,
+                         const std::string &language)
+{
+    //std::clog << basename((char *)__FILE__) << ":" << __LINE__ << " " << atc << std::endl;
+    
+    if (atc.empty())
+        return {};
+
+    // First check ordered set, quicker than going through the whole vector
+    if (statsUniqueAtcSet.find(atc) == statsUniqueAtcSet.end())
+        return {};
+    
+    // Issue #70
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if (statsUniqueUsedAtcSet.find(atc) == statsUniqueUsedAtcSet.end())
+            statsUniqueUsedAtcSet.insert(atc);
+        else
+            statsRepeatedAtcCount++;
+    }
+
+    std::string html;
+
+    //---
+    auto bfSearch = breastFeedAtcMap.find(atc);
+    if (bfSearch == breastFeedAtcMap.end()) {
+        statsBfByAtcNotFoundCount++;
+    }
+    else {
+        statsBfByAtcFoundCount++;
+#ifdef SAPPINFO_NEW_STATS
+        std::lock_guard<std::mutex> lock(statsMutex);
+        statsUniqueAtcSheet1Set.insert(atc);
+#endif
+    }
+
+    if (bfSearch != breastFeedAtcMap.end()) {
+        const std::vector<std::string> &bfHtml = breastFeedHtmlMap.at(language);
+        for (size_t i : bfSearch->second)
+            html += bfHtml[i];
+
+        statsTablesCount[0] += bfSearch->second.size();
+    }
+
+    //---
+    auto pregnSearch = pregnancyAtcMap.find(atc);
+    if (pregnSearch == pregnancyAtcMap.end()) {
+        statsPregnByAtcNotFoundCount++;
+    }
+    else {
+        statsPregnByAtcFoundCount++;
+#ifdef SAPPINFO_NEW_STATS
+        std::lock_guard<std::mutex> lock(statsMutex);
+        statsUniqueAtcSheet2Set.insert(atc);
+#endif
+    }
+
+    if (pregnSearch != pregnancyAtcMap.end()) {
+        const std::vector<std::string> &pregnHtml = pregnancyHtmlMap.at(language);
+        for (size_t i : pregnSearch->second)
+            html += pregnHtml[i];
+
+        statsTablesCount[1] += pregnSearch->second.size();
+    }
 
     return html;
 }
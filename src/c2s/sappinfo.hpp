@@ -47,8 +47,9 @@ namespace SAPP
 
     void parseXLXS(const std::string &inDir,
                    const std::string &filename,
-                   const std::string &language);
-    std::string getHtmlByAtc(const std::string atc);
+                   const std::vector<std::string> &languages);
+    std::string getHtmlByAtc(const std::string atc,
+                             const std::string &language);
     
     void printUsageStats();
 }
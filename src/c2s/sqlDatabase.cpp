@@ -9,21 +9,261 @@
 
 #include <iostream>
 #include <sstream>
+#include <chrono>
+#include <iomanip>
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
 #include <sqlite3.h>
 #include <libgen.h>     // for basename()
+#include <fcntl.h>      // for open()
+#include <unistd.h>     // for fsync()
 
 #include "sqlDatabase.hpp"
+#include "report.hpp"
 
 // See SqlDatabase.java:65
 #define FI_DB_VERSION   "140"
 
+// Build-time cache, in KiB (negative value for sqlite)
+#define BULK_LOAD_CACHE_SIZE    "-65536"
+
 namespace AIPS
 {
-    static sqlite3 *db;
 
-void createIndex(const std::string &tableName,
-                 const std::string &prefix,
-                 const std::vector<std::string> &keys)
+Database::Database(const std::string &filename, bool inMemory)
+: db(nullptr)
+, filename(filename)
+, inMemory(inMemory)
+, schemaMode(SchemaMode::single)
+, fullText(false)
+, incremental(false)
+, bulkLoad(false)
+, bulkBatchSize(BULK_LOAD_BATCH_SIZE)
+, bulkRowsInBatch(0)
+{
+    // Leftover from an interrupted run
+    std::remove(getWorkFilename().c_str());
+
+    int rc = sqlite3_open(inMemory ? ":memory:" : getWorkFilename().c_str(), &db);
+    if (rc != SQLITE_OK)
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", error " << rc
+        << ", " << filename
+        << std::endl;
+}
+
+// Same directory as the final file, so that rename() is atomic
+std::string Database::getWorkFilename() const
+{
+    return filename + ".tmp";
+}
+
+Database::~Database()
+{
+    close();
+}
+
+void Database::close()
+{
+    if (!db)
+        return;
+
+    endBulkLoad();
+
+    for (auto s : statementMap) {
+        // Destroy the object
+        int rc = sqlite3_finalize(s.second);
+        if ((rc != SQLITE_OK) && (rc != SQLITE_DONE))
+            std::cerr
+            << basename((char *)__FILE__) << ":" << __LINE__
+            << ", error " << rc
+            << std::endl;
+    }
+
+    statementMap.clear();
+    boundTextMap.clear();
+
+    int rc = sqlite3_close(db);
+    if (rc != SQLITE_OK)
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", rc" << rc
+        << std::endl;
+
+    db = nullptr;
+}
+
+// All the pages in one step
+// Return SQLITE_OK or the error
+static int copyDatabase(sqlite3 *dest, sqlite3 *source)
+{
+    sqlite3_backup *backup = sqlite3_backup_init(dest, "main", source, "main");
+    if (!backup)
+        return sqlite3_errcode(dest);
+
+    int rc = sqlite3_backup_step(backup, -1);
+    int rcFinish = sqlite3_backup_finish(backup);
+    if (rc != SQLITE_DONE)
+        return (rc == SQLITE_OK) ? SQLITE_ERROR : rc;   // not complete
+
+    return rcFinish;
+}
+
+static bool syncFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    int rc = fsync(fd);
+    ::close(fd);
+    return rc == 0;
+}
+
+// Readers polling the output directory see either the previous file or the
+// complete new one, never a partially written database
+bool Database::publish()
+{
+    if (!db)
+        return false;
+
+    const std::string workFilename = getWorkFilename();
+
+    if (inMemory) {
+        endBulkLoad();
+
+        sqlite3 *dest = nullptr;
+        int rc = sqlite3_open(workFilename.c_str(), &dest);
+        if (rc == SQLITE_OK)
+            rc = copyDatabase(dest, db);
+
+        if (rc != SQLITE_OK)
+            std::cerr
+            << basename((char *)__FILE__) << ":" << __LINE__
+            << ", error " << rc
+            << ", " << sqlite3_errmsg(dest)
+            << ", " << workFilename
+            << std::endl;
+
+        sqlite3_close(dest);
+        close();
+        if (rc != SQLITE_OK) {
+            std::remove(workFilename.c_str());
+            return false;
+        }
+    }
+    else {
+        close();
+    }
+
+    // The bulk load doesn't fsync, make sure the data is on disk before the rename
+    if (!syncFile(workFilename)) {
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", cannot sync " << workFilename
+        << std::endl;
+        std::remove(workFilename.c_str());
+        return false;
+    }
+
+    if (std::rename(workFilename.c_str(), filename.c_str()) != 0) {
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", cannot rename " << workFilename
+        << " to " << filename
+        << std::endl;
+        return false;
+    }
+
+    // The rename itself is on disk once the directory is
+    std::string::size_type slash = filename.find_last_of('/');
+    const std::string directory = (slash == std::string::npos) ? "." : filename.substr(0, slash + 1);
+    if (!syncFile(directory)) {
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", cannot sync " << directory
+        << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Start from a copy of the published file, if there is one
+bool Database::restore()
+{
+    sqlite3 *source = nullptr;
+    int rc = sqlite3_open_v2(filename.c_str(), &source, SQLITE_OPEN_READONLY, NULL);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(source);
+        return false;
+    }
+
+    rc = copyDatabase(db, source);
+    if (rc != SQLITE_OK)
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", error " << rc
+        << ", " << sqlite3_errmsg(db)
+        << ", " << filename
+        << std::endl;
+
+    sqlite3_close(source);
+    return rc == SQLITE_OK;
+}
+
+void Database::execute(const std::string &sql)
+{
+    char *errmsg;
+    int rc = sqlite3_exec(db, sql.c_str(), NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK) {
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", error " << rc
+        << ", " << errmsg
+        << ", " << sql
+        << std::endl;
+        sqlite3_free(errmsg);
+    }
+}
+
+// The database is regenerated from scratch on every run, so while it is being
+// populated there is no need for a rollback journal on disk or for an fsync
+// after each row. Rows are committed in batches instead of one at a time.
+void Database::beginBulkLoad(unsigned int batchSize)
+{
+    execute("PRAGMA journal_mode=MEMORY;");
+    execute("PRAGMA synchronous=OFF;");
+    execute("PRAGMA cache_size=" BULK_LOAD_CACHE_SIZE ";");
+    execute("PRAGMA temp_store=MEMORY;");
+
+    bulkBatchSize = (batchSize > 0) ? batchSize : 1;
+    bulkRowsInBatch = 0;
+    bulkLoad = true;
+    execute("BEGIN TRANSACTION;");
+}
+
+// Commit the last batch and restore the default (safe) settings
+// so that the file is left in a consistent state before sqlite3_close()
+void Database::endBulkLoad()
+{
+    if (!bulkLoad)
+        return;
+
+    execute("COMMIT;");
+    bulkLoad = false;
+
+    execute("PRAGMA synchronous=FULL;");
+    execute("PRAGMA journal_mode=DELETE;");
+    execute("PRAGMA cache_size=-2000;");
+    execute("PRAGMA temp_store=DEFAULT;");
+}
+
+void Database::createIndex(const std::string &tableName,
+                           const std::string &prefix,
+                           const std::vector<std::string> &keys)
 {
     char *errmsg;
     for (std::string k : keys) {
@@ -42,19 +282,23 @@ void createIndex(const std::string &tableName,
     }
 }
 
-void destroyStatement(sqlite3_stmt * statement)
+void Database::deferIndex(const std::string &tableName,
+                          const std::string &prefix,
+                          const std::vector<std::string> &keys)
 {
-    // Destroy the object
-    int rc = sqlite3_finalize(statement);
-    if ((rc != SQLITE_OK) && (rc != SQLITE_DONE))
-        std::cerr
-        << basename((char *)__FILE__) << ":" << __LINE__
-        << ", error " << rc
-        << std::endl;
+    deferredIndexVec.push_back({tableName, prefix, keys});
+}
+
+void Database::createDeferredIndexes()
+{
+    for (auto di : deferredIndexVec)
+        createIndex(di.tableName, di.prefix, di.keys);
+
+    deferredIndexVec.clear();
 }
 
-void runStatement(const std::string &tableName,
-                  sqlite3_stmt * statement)
+void Database::runStatement(const std::string &tableName,
+                            sqlite3_stmt * statement)
 {
     // Run the SQL
     int rc = sqlite3_step(statement);
@@ -66,22 +310,35 @@ void runStatement(const std::string &tableName,
         std::cerr
         << basename((char *)__FILE__) << ":" << __LINE__
         << ", error " << rc
+        << ", table: " << tableName
         << ", statement: " << expString.substr(0,200)
         << std::endl;
     }
 
     rc = sqlite3_reset(statement);
+
+    // Don't leave pointers to the caller's text bound to the statement
+    sqlite3_clear_bindings(statement);
+    auto bound = boundTextMap.find(statement);
+    if (bound != boundTextMap.end())
+        bound->second.clear();
+
+    if (bulkLoad && (++bulkRowsInBatch >= bulkBatchSize)) {
+        execute("COMMIT;");
+        execute("BEGIN TRANSACTION;");
+        bulkRowsInBatch = 0;
+    }
 }
 
-void bindText(const std::string &tableName,
-              sqlite3_stmt * statement,
-              int pos,
-              const std::string &text)
+void Database::bindText(sqlite3_stmt * statement,
+                        int pos,
+                        std::string_view text)
 {
     //std::cout << basename((char *)__FILE__) << ":" << __LINE__
     //          << " pos:" << pos << " text:" << text << std::endl;
 
-    int rc = sqlite3_bind_text(statement, pos, text.c_str(), -1, SQLITE_TRANSIENT);
+    // Explicit length, so sqlite doesn't have to call strlen()
+    int rc = sqlite3_bind_text64(statement, pos, text.data(), text.size(), SQLITE_STATIC, SQLITE_UTF8);
     if (rc != SQLITE_OK)
         std::cerr
         << basename((char *)__FILE__) << ":" << __LINE__
@@ -89,26 +346,81 @@ void bindText(const std::string &tableName,
         << std::endl;
 }
 
-void prepareStatement(const std::string &tableName,
-                      sqlite3_stmt ** statement,
-                      const std::string &placeholders)
+void Database::bindText(sqlite3_stmt * statement,
+                        int pos,
+                        std::string &&text)
+{
+    std::deque<std::string> &bound = boundTextMap[statement];
+    bound.push_back(std::move(text));
+    bindText(statement, pos, std::string_view(bound.back()));
+}
+
+void Database::bindText(sqlite3_stmt * statement,
+                        int pos,
+                        const char *text)
+{
+    bindText(statement, pos, std::string_view(text));
+}
+
+void Database::bindInt(sqlite3_stmt * statement,
+                       int pos,
+                       sqlite3_int64 value)
 {
+    int rc = sqlite3_bind_int64(statement, pos, value);
+    if (rc != SQLITE_OK)
+        std::cerr
+        << basename((char *)__FILE__) << ":" << __LINE__
+        << ", error " << rc
+        << std::endl;
+}
+
+sqlite3_stmt * Database::prepareStatement(const std::string &tableName,
+                                          const std::string &placeholders)
+{
+    const std::string key = tableName + "(" + placeholders + ")";
+    auto search = statementMap.find(key);
+    if (search != statementMap.end())
+        return search->second;
+
     std::ostringstream sqlStream;
     sqlStream << "INSERT INTO " << tableName
               << " VALUES (" << placeholders << ");";
     //std::cout << basename((char *)__FILE__) << ":" << __LINE__ << " " << sqlStream.str() << std::endl;
-    
-    int rc = sqlite3_prepare_v2(db, sqlStream.str().c_str(), -1, statement, NULL);
+
+    sqlite3_stmt *statement = prepare(sqlStream.str());
+    statementMap.insert(std::make_pair(key, statement));
+    return statement;
+}
+
+sqlite3_stmt * Database::prepareSql(const std::string &sql)
+{
+    auto search = statementMap.find(sql);
+    if (search != statementMap.end())
+        return search->second;
+
+    sqlite3_stmt *statement = prepare(sql);
+    statementMap.insert(std::make_pair(sql, statement));
+    return statement;
+}
+
+sqlite3_stmt * Database::prepare(const std::string &sql)
+{
+    sqlite3_stmt *statement = nullptr;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, NULL);
     if (rc != SQLITE_OK)
         std::cerr
         << basename((char *)__FILE__) << ":" << __LINE__
         << ", error " << rc
+        << ", " << sqlite3_errmsg(db)
+        << ", " << sql
         << std::endl;
+
+    return statement;
 }
 
-void insertInto(const std::string &tableName,
-                const std::string &keys,
-                const std::string &values)
+void Database::insertInto(const std::string &tableName,
+                          const std::string &keys,
+                          const std::string &values)
 {
     std::ostringstream sqlStream;
     int rc;
@@ -129,7 +441,7 @@ void insertInto(const std::string &tableName,
     }
 }
 
-void createTable(const std::string &tableName, const std::string &keys)
+void Database::createTable(const std::string &tableName, const std::string &keys)
 {
     std::ostringstream sqlStream;
     int rc;
@@ -143,7 +455,7 @@ void createTable(const std::string &tableName, const std::string &keys)
         << ", error " << rc
         << ", " << errmsg
         << std::endl;
-    
+
     sqlStream << "DROP TABLE IF EXISTS " << tableName << ";";
     rc = sqlite3_exec(db, sqlStream.str().c_str(), NULL, NULL, &errmsg);
     if (rc != SQLITE_OK)
@@ -152,7 +464,7 @@ void createTable(const std::string &tableName, const std::string &keys)
         << ", error " << rc
         << ", " << errmsg
         << std::endl;
-    
+
     // See SqlDatabase.java 207
     sqlStream.str("");
     sqlStream << "CREATE TABLE " << tableName << "(" << keys.c_str() << ");";
@@ -165,26 +477,542 @@ void createTable(const std::string &tableName, const std::string &keys)
         << std::endl;
 }
 
-sqlite3 * createDB(const std::string &filename)
+#pragma mark -
+
+static void appendUtf8(std::string &s, unsigned long cp)
+{
+    if (cp < 0x80) {
+        s += (char)cp;
+    }
+    else if (cp < 0x800) {
+        s += (char)(0xC0 | (cp >> 6));
+        s += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        s += (char)(0xE0 | (cp >> 12));
+        s += (char)(0x80 | ((cp >> 6) & 0x3F));
+        s += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x110000) {
+        s += (char)(0xF0 | (cp >> 18));
+        s += (char)(0x80 | ((cp >> 12) & 0x3F));
+        s += (char)(0x80 | ((cp >> 6) & 0x3F));
+        s += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+// Plain text of the monograph, for the full text index
+// Tags become a single space so that words in adjacent cells don't get merged
+std::string htmlToText(std::string_view html)
+{
+    std::string text;
+    text.reserve(html.size() / 2);
+    bool space = true;  // don't start with a space
+
+    std::string_view::size_type i = 0;
+    while (i < html.size()) {
+        char c = html[i];
+        if (c == '<') {
+            std::string_view::size_type end = html.find('>', i);
+            if (end == std::string_view::npos)
+                break;
+
+            i = end + 1;
+            if (!space) {
+                text += ' ';
+                space = true;
+            }
+
+            continue;
+        }
+
+        if (c == '&') {
+            std::string_view::size_type end = html.find(';', i);
+            if ((end != std::string_view::npos) && (end - i <= 10)) {
+                std::string_view entity = html.substr(i + 1, end - i - 1);
+                if (entity == "shy") {  // soft hyphen, within a word
+                    i = end + 1;
+                    continue;
+                }
+
+                unsigned long cp = 0;
+                if (entity == "amp")        cp = '&';
+                else if (entity == "lt")    cp = '<';
+                else if (entity == "gt")    cp = '>';
+                else if (entity == "quot")  cp = '"';
+                else if (entity == "apos")  cp = '\'';
+                else if (entity == "nbsp")  cp = ' ';
+                else if ((entity.size() > 1) && (entity[0] == '#')) {
+                    std::string number(entity.substr(1));
+                    if ((number[0] == 'x') || (number[0] == 'X'))
+                        cp = std::strtoul(number.c_str() + 1, nullptr, 16);
+                    else
+                        cp = std::strtoul(number.c_str(), nullptr, 10);
+                }
+
+                if (cp != 0) {
+                    if (std::isspace((int)cp)) {
+                        if (!space)
+                            text += ' ';
+
+                        space = true;
+                    }
+                    else {
+                        appendUtf8(text, cp);
+                        space = false;
+                    }
+
+                    i = end + 1;
+                    continue;
+                }
+            }
+        }
+
+        if (std::isspace((unsigned char)c)) {
+            if (!space)
+                text += ' ';
+
+            space = true;
+        }
+        else {
+            text += c;
+            space = false;
+        }
+
+        i++;
+    }
+
+    if (space && !text.empty())
+        text.pop_back();
+
+    return text;
+}
+
+// SQL function html_to_text(x)
+static void sqlHtmlToText(sqlite3_context *context, int /*argc*/, sqlite3_value **argv)
+{
+    const char *html = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+    if (!html) {
+        sqlite3_result_null(context);
+        return;
+    }
+
+    std::string text = htmlToText(std::string_view(html, sqlite3_value_bytes(argv[0])));
+    sqlite3_result_text64(context, text.data(), text.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+}
+
+// On the generator connection only, clients don't have these functions
+static void registerFunctions(Database &db)
 {
-    int rc = sqlite3_open(filename.c_str(), &db);
+    int rc = sqlite3_create_function_v2(db.handle(), "html_to_text", 1,
+                                        SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                        nullptr, sqlHtmlToText, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK)
         std::cerr
         << basename((char *)__FILE__) << ":" << __LINE__
         << ", error " << rc
         << std::endl;
+}
+
+#pragma mark -
+
+static std::string secondsSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(3) << elapsed.count() << " s";
+    return s.str();
+}
+
+// "?, ?, ?" with n question marks
+static std::string placeholders(int n)
+{
+    std::string s;
+    for (int i=0; i<n; i++)
+        s += (i == 0) ? "?" : ", ?";
 
-    createTable("amikodb", "_id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, auth TEXT, atc TEXT, substances TEXT, regnrs TEXT, atc_class TEXT, tindex_str TEXT, application_str TEXT, indications_str TEXT, customer_id INTEGER, pack_info_str TEXT, add_info_str TEXT, ids_str TEXT, titles_str TEXT, content TEXT, style_str TEXT, packages TEXT");
-    createIndex("amikodb", "idx_", {"title", "auth", "atc", "substances", "regnrs", "atc_class"});
+    return s;
+}
+
+void insertProduct(Database &db, ProductRow &&row)
+{
+    sqlite3_stmt *statement = db.prepareStatement("productdb", "null, ?, ?, ?, ?, ?");
+    db.bindText(statement, 1, std::move(row.title));
+    db.bindText(statement, 2, std::move(row.author));
+    db.bindText(statement, 3, std::move(row.eancodes));
+    db.bindText(statement, 4, std::move(row.packInfo));
+    db.bindText(statement, 5, std::move(row.packages));
+    db.runStatement("productdb", statement);
+}
+
+// A column of sqlite_master for the object, empty if there is no such object
+static std::string objectInfo(Database &db, const std::string &name, const std::string &column)
+{
+    sqlite3_stmt *statement = nullptr;
+    sqlite3_prepare_v2(db.handle(), ("SELECT " + column + " FROM sqlite_master WHERE name=?;").c_str(), -1, &statement, NULL);
+    db.bindText(statement, 1, std::string_view(name));
+    std::string info;
+    if ((sqlite3_step(statement) == SQLITE_ROW) &&
+        (sqlite3_column_type(statement, 0) != SQLITE_NULL))
+        info = reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+
+    sqlite3_finalize(statement);
+    return info;
+}
+
+// "table", "view", ... or empty if there is no such object
+static std::string objectType(Database &db, const std::string &name)
+{
+    return objectInfo(db, name, "type");
+}
+
+// The file might be left over from a run with another schema mode
+static void dropAmikodb(Database &db)
+{
+    db.execute("DROP TABLE IF EXISTS amikodb_fts;");
+
+    std::string type = objectType(db, "amikodb");
+    if (type == "view")
+        db.execute("DROP VIEW amikodb;");
+    else if (type == "table")
+        db.execute("DROP TABLE amikodb;");
+
+    db.execute("DROP TABLE IF EXISTS amikodb_meta;");
+    db.execute("DROP TABLE IF EXISTS amikodb_content;");
+}
+
+// In the split modes amikodb_meta keeps the small columns used by list and
+// search screens, so that scanning them doesn't walk the overflow pages of
+// the HTML. The view keeps the original column order for existing queries.
+void createDB(Database &db, SchemaMode mode, bool fullText)
+{
+    db.setSchemaMode(mode);
+    db.setFullText(fullText);
+    db.setIncremental(false);
+    registerFunctions(db);
+    dropAmikodb(db);
 
-    createTable("productdb", "_id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, author TEXT, eancodes TEXT, pack_info_str TEXT, packages TEXT");
-    createIndex("productdb", "idx_prod_", {"title", "author", "eancodes"});
-    
-    createTable("android_metadata", "locale TEXT default 'en_US'");
-    insertInto("android_metadata", "locale", "'en_US'");
+    if (mode == SchemaMode::single) {
+        db.createTable("amikodb", "_id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, auth TEXT, atc TEXT, substances TEXT, regnrs TEXT, atc_class TEXT, tindex_str TEXT, application_str TEXT, indications_str TEXT, customer_id INTEGER, pack_info_str TEXT, add_info_str TEXT, ids_str TEXT, titles_str TEXT, content TEXT, style_str TEXT, packages TEXT");
+        db.deferIndex("amikodb", "idx_", {"title", "auth", "atc", "substances", "regnrs", "atc_class"});
+    }
+    else {
+        const bool splitPackages = (mode == SchemaMode::splitContentPackages);
+        std::string metaKeys = "_id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, auth TEXT, atc TEXT, substances TEXT, regnrs TEXT, atc_class TEXT, tindex_str TEXT, application_str TEXT, indications_str TEXT, customer_id INTEGER, pack_info_str TEXT, add_info_str TEXT, ids_str TEXT, titles_str TEXT, style_str TEXT";
+        std::string contentKeys = "_id INTEGER PRIMARY KEY, content TEXT";
+        if (splitPackages)
+            contentKeys += ", packages TEXT";
+        else
+            metaKeys += ", packages TEXT";
+
+        db.createTable("amikodb_meta", metaKeys);
+        db.createTable("amikodb_content", contentKeys);
+        db.deferIndex("amikodb_meta", "idx_", {"title", "auth", "atc", "substances", "regnrs", "atc_class"});
+
+        db.execute(std::string("CREATE VIEW amikodb AS SELECT m._id, m.title, m.auth, m.atc, m.substances, m.regnrs, m.atc_class, m.tindex_str, m.application_str, m.indications_str, m.customer_id, m.pack_info_str, m.add_info_str, m.ids_str, m.titles_str, c.content, m.style_str, ")
+                   + (splitPackages ? "c" : "m") + ".packages"
+                   + " FROM amikodb_meta m JOIN amikodb_content c ON c._id = m._id;");
+    }
+
+    // The monograph is indexed as plain text, so the index keeps its own copy
+    // of it: highlight(), snippet(), 'rebuild' and 'integrity-check' then work
+    // on the same text that was tokenized, without html_to_text() in the client.
+    // rowid is the _id in amikodb.
+    // The index is populated by finalizeDB()
+    if (fullText)
+        db.execute("CREATE VIRTUAL TABLE amikodb_fts USING fts5("
+                   "title, substances, content, pack_info_str, "
+                   "tokenize='unicode61 remove_diacritics 2');");
+
+    // One row per package line of amikodb.packages, for barcode lookups
+    db.createTable("packages", "_id INTEGER PRIMARY KEY AUTOINCREMENT, amikodb_id INTEGER, gtin INTEGER, phar TEXT, dosage TEXT, units TEXT, efp TEXT, pp TEXT, flags TEXT");
+    db.deferIndex("packages", "idx_pack_", {"gtin", "phar", "amikodb_id"});
+
+    db.createTable("productdb", "_id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT, author TEXT, eancodes TEXT, pack_info_str TEXT, packages TEXT");
+    db.deferIndex("productdb", "idx_prod_", {"title", "author", "eancodes"});
+
+    db.createTable("android_metadata", "locale TEXT default 'en_US'");
+    db.insertInto("android_metadata", "locale", "'en_US'");
+
+    // For the next incremental run
+    db.createTable("amikodb_hash", "_id INTEGER PRIMARY KEY, key TEXT, hash TEXT");
+    db.createTable("build_info", "name TEXT PRIMARY KEY, value TEXT");
 
     //createTable("sqlite_sequence", "");  // created automatically
-    return db;
+}
+
+// Continue from the database restored from the previous run
+// Return false if its schema is not the requested one, then use createDB()
+bool reopenDB(Database &db, SchemaMode mode, bool fullText)
+{
+    std::string amikoType = objectType(db, "amikodb");
+    if (amikoType != ((mode == SchemaMode::single) ? "table" : "view"))
+        return false;
+
+    if (fullText != !objectType(db, "amikodb_fts").empty())
+        return false;
+
+    // Earlier the index read its text back from amikodb, as external content
+    if (objectInfo(db, "amikodb_fts", "sql").find("content=") != std::string::npos)
+        return false;
+
+    if (objectType(db, "amikodb_hash").empty() ||
+        objectType(db, "build_info").empty() ||
+        objectType(db, "packages").empty())
+        return false;
+
+    // Where packages is stored is the difference between the two split modes
+    if (mode != SchemaMode::single) {
+        sqlite3_stmt *statement = nullptr;
+        int rc = sqlite3_prepare_v2(db.handle(), "SELECT packages FROM amikodb_content;", -1, &statement, NULL);
+        sqlite3_finalize(statement);
+        if ((rc == SQLITE_OK) != (mode == SchemaMode::splitContentPackages))
+            return false;
+    }
+
+    db.setSchemaMode(mode);
+    db.setFullText(fullText);
+    db.setIncremental(true);
+    registerFunctions(db);
+
+    // productdb is cheap enough to regenerate every time
+    db.execute("DELETE FROM productdb;");
+    return true;
+}
+
+std::map<std::string, AmikoHash> getAmikoHashes(Database &db)
+{
+    std::map<std::string, AmikoHash> hashMap;
+
+    sqlite3_stmt *statement = db.prepareSql("SELECT _id, key, hash FROM amikodb_hash;");
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        AmikoHash h;
+        h.id = sqlite3_column_int64(statement, 0);
+        h.hash = reinterpret_cast<const char *>(sqlite3_column_text(statement, 2));
+        hashMap[reinterpret_cast<const char *>(sqlite3_column_text(statement, 1))] = h;
+    }
+
+    sqlite3_reset(statement);
+    return hashMap;
+}
+
+std::string getBuildInfo(Database &db, const std::string &name)
+{
+    std::string value;
+
+    sqlite3_stmt *statement = db.prepareSql("SELECT value FROM build_info WHERE name=?;");
+    db.bindText(statement, 1, std::string_view(name));
+    if (sqlite3_step(statement) == SQLITE_ROW)
+        value = reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    return value;
+}
+
+void setBuildInfo(Database &db, const std::string &name, const std::string &value)
+{
+    sqlite3_stmt *statement = db.prepareSql("INSERT OR REPLACE INTO build_info VALUES (?, ?);");
+    db.bindText(statement, 1, std::string_view(name));
+    db.bindText(statement, 2, std::string_view(value));
+    db.runStatement("build_info", statement);
+}
+
+// See DispoParse.java:164 addArticleDB()
+// See SqlDatabase.java:347 addExpertDB()
+sqlite3_int64 insertAmiko(Database &db, AmikoRow &&row, sqlite3_int64 rowId)
+{
+    const bool split = (db.getSchemaMode() != SchemaMode::single);
+    const bool splitPackages = (db.getSchemaMode() == SchemaMode::splitContentPackages);
+
+    // Columns after _id, in the main table
+    int nColumns = 17;
+    if (split)
+        nColumns--;
+
+    if (splitPackages)
+        nColumns--;
+
+    const std::string tableName = split ? "amikodb_meta" : "amikodb";
+    sqlite3_stmt *statement = db.prepareStatement(tableName, placeholders(nColumns + 1));
+
+    // Left NULL for a new _id
+    if (rowId > 0)
+        db.bindInt(statement, 1, rowId);
+
+    int pos = 2;
+    db.bindText(statement, pos++, std::move(row.title));
+    db.bindText(statement, pos++, std::move(row.auth));
+    db.bindText(statement, pos++, std::move(row.atc));
+    db.bindText(statement, pos++, std::move(row.substances));
+    db.bindText(statement, pos++, std::move(row.regnrs));
+    db.bindText(statement, pos++, std::move(row.atcClass));
+    db.bindText(statement, pos++, std::move(row.tindex));
+    db.bindText(statement, pos++, std::move(row.application));
+    db.bindText(statement, pos++, std::move(row.indications));
+    db.bindText(statement, pos++, std::move(row.customerId));
+    db.bindText(statement, pos++, std::move(row.packInfo));
+    db.bindText(statement, pos++, std::move(row.addInfo));
+    db.bindText(statement, pos++, std::move(row.ids));
+    db.bindText(statement, pos++, std::move(row.titles));
+    if (!split)
+        db.bindText(statement, pos++, std::move(row.content));
+
+    pos++;  // TODO: style_str
+
+    if (!splitPackages)
+        db.bindText(statement, pos++, std::move(row.packages));
+
+    db.runStatement(tableName, statement);
+    rowId = sqlite3_last_insert_rowid(db.handle());
+
+    if (split) {
+        statement = db.prepareStatement("amikodb_content", placeholders(splitPackages ? 3 : 2));
+        db.bindInt(statement, 1, rowId);
+        db.bindText(statement, 2, std::move(row.content));
+        if (splitPackages)
+            db.bindText(statement, 3, std::move(row.packages));
+
+        db.runStatement("amikodb_content", statement);
+    }
+
+    for (PackageRow &p : row.packageRows) {
+        statement = db.prepareStatement("packages", "null, ?, ?, ?, ?, ?, ?, ?, ?");
+        db.bindInt(statement, 1, rowId);
+
+        // Leave it NULL if it's not a number
+        char *end;
+        long long gtin = std::strtoll(p.gtin.c_str(), &end, 10);
+        if (!p.gtin.empty() && (*end == '\0'))
+            db.bindInt(statement, 2, gtin);
+
+        db.bindText(statement, 3, std::move(p.phar));
+        db.bindText(statement, 4, std::move(p.dosage));
+        db.bindText(statement, 5, std::move(p.units));
+        db.bindText(statement, 6, std::move(p.efp));
+        db.bindText(statement, 7, std::move(p.pp));
+        db.bindText(statement, 8, std::move(p.flags));
+        db.runStatement("packages", statement);
+    }
+
+    if (!row.key.empty()) {
+        statement = db.prepareStatement("amikodb_hash", "?, ?, ?");
+        db.bindInt(statement, 1, rowId);
+        db.bindText(statement, 2, std::move(row.key));
+        db.bindText(statement, 3, std::move(row.hash));
+        db.runStatement("amikodb_hash", statement);
+    }
+
+    // In a full build the index is populated at the end by finalizeDB()
+    if (db.isIncremental() && db.isFullText()) {
+        statement = db.prepareSql("INSERT INTO amikodb_fts(rowid, title, substances, content, pack_info_str) "
+                                  "SELECT _id, title, substances, html_to_text(content), pack_info_str FROM amikodb WHERE _id=?;");
+        db.bindInt(statement, 1, rowId);
+        db.runStatement("amikodb_fts", statement);
+    }
+
+    return rowId;
+}
+
+// Remove the row and everything that refers to it
+void deleteAmiko(Database &db, sqlite3_int64 rowId)
+{
+    if (db.isFullText()) {
+        sqlite3_stmt *statement = db.prepareSql("DELETE FROM amikodb_fts WHERE rowid=?;");
+        db.bindInt(statement, 1, rowId);
+        db.runStatement("amikodb_fts", statement);
+    }
+
+    std::vector<std::string> tables {"amikodb_hash"};
+    if (db.getSchemaMode() == SchemaMode::single) {
+        tables.push_back("amikodb");
+    }
+    else {
+        tables.push_back("amikodb_meta");
+        tables.push_back("amikodb_content");
+    }
+
+    for (auto t : tables) {
+        sqlite3_stmt *statement = db.prepareSql("DELETE FROM " + t + " WHERE _id=?;");
+        db.bindInt(statement, 1, rowId);
+        db.runStatement(t, statement);
+    }
+
+    sqlite3_stmt *statement = db.prepareSql("DELETE FROM packages WHERE amikodb_id=?;");
+    db.bindInt(statement, 1, rowId);
+    db.runStatement("packages", statement);
+}
+
+#pragma mark -
+
+// 64-bit FNV-1a
+void Hash::add(std::string_view data)
+{
+    for (unsigned char c : data) {
+        value ^= c;
+        value *= 0x100000001b3ULL;
+    }
+
+    // Field separator, so that "ab","c" differs from "a","bc"
+    value ^= 0xff;
+    value *= 0x100000001b3ULL;
+}
+
+std::string Hash::str() const
+{
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << value;
+    return s.str();
+}
+
+// One bulk insert instead of updating the index row by row during the load
+static void populateFullTextIndex(Database &db)
+{
+    db.execute("DELETE FROM amikodb_fts;");
+    db.execute("INSERT INTO amikodb_fts(rowid, title, substances, content, pack_info_str) "
+               "SELECT _id, title, substances, html_to_text(content), pack_info_str FROM amikodb;");
+    db.execute("INSERT INTO amikodb_fts(amikodb_fts) VALUES('optimize');");
+}
+
+// To be called once all the rows have been inserted
+// A page size other than 0 implies a vacuum, because that's the only way to change it
+void finalizeDB(Database &db,
+                bool vacuum,
+                int pageSize)
+{
+    REP::html_h2("Database finalization");
+    REP::html_start_ul();
+
+    std::clog << std::endl << "Creating indexes" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    db.beginBulkLoad();    // for the larger cache
+    db.createDeferredIndexes();
+    REP::html_li("create indexes: " + secondsSince(start));
+
+    // Incremental runs keep the index up to date row by row
+    if (db.isFullText() && !db.isIncremental()) {
+        std::clog << "Creating full text index" << std::endl;
+        start = std::chrono::steady_clock::now();
+        populateFullTextIndex(db);
+        REP::html_li("full text index: " + secondsSince(start));
+    }
+
+    start = std::chrono::steady_clock::now();
+    db.execute("ANALYZE;");
+    db.endBulkLoad();
+    REP::html_li("analyze: " + secondsSince(start));
+
+    if (vacuum || (pageSize > 0)) {
+        std::clog << "Compacting database" << std::endl;
+        start = std::chrono::steady_clock::now();
+        if (pageSize > 0)
+            db.execute("PRAGMA page_size=" + std::to_string(pageSize) + ";");
+
+        db.execute("VACUUM;");
+        REP::html_li("vacuum: " + secondsSince(start));
+    }
+
+    REP::html_end_ul();
 }
 
 }
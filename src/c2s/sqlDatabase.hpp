@@ -10,36 +10,240 @@
 #ifndef sqlDatabase_hpp
 #define sqlDatabase_hpp
 
+#include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <map>
+#include <sqlite3.h>
+
+// Rows per transaction while in bulk-load mode
+#define BULK_LOAD_BATCH_SIZE    500
 
 namespace AIPS
 {
-    sqlite3 * createDB(const std::string &filename);
-
-    void createTable(const std::string &tableName,
-                     const std::string &keys);
-
-    void createIndex(const std::string &tableName,
-                     const std::string &prefix,
-                     const std::vector<std::string> &keys);
-    
-    void prepareStatement(const std::string &tableName,
-                          sqlite3_stmt ** statement,
-                          const std::string &placeholders);
-
-    void destroyStatement(sqlite3_stmt * statement);
-    
-    void bindText(const std::string &tableName,
-                  sqlite3_stmt * statement,
-                  int pos,
-                  const std::string &text);
-
-    void runStatement(const std::string &tableName,
-                      sqlite3_stmt * statement);
-
-    void insertInto(const std::string &tableName,
-                    const std::string &keys,
-                    const std::string &values);
+    // How the large columns of amikodb are stored
+    enum class SchemaMode {
+        single,                 // everything in amikodb
+        splitContent,           // content in amikodb_content, amikodb is a view
+        splitContentPackages    // content and packages in amikodb_content
+    };
+
+    // Owns one sqlite connection and the statements prepared on it,
+    // so that more than one database can be open at the same time
+    //
+    // The database is built in a work file next to filename, or in memory,
+    // and nothing is written to filename until publish()
+    class Database
+    {
+    public:
+        Database(const std::string &filename, bool inMemory = false);
+        ~Database();
+
+        Database(const Database &) = delete;
+        Database & operator=(const Database &) = delete;
+
+        sqlite3 * handle() const { return db; }
+        const std::string & getFilename() const { return filename; }
+        std::string getWorkFilename() const;
+
+        void execute(const std::string &sql);
+
+        void createTable(const std::string &tableName,
+                         const std::string &keys);
+
+        void createIndex(const std::string &tableName,
+                         const std::string &prefix,
+                         const std::vector<std::string> &keys);
+
+        // The index will be created by createDeferredIndexes()
+        void deferIndex(const std::string &tableName,
+                        const std::string &prefix,
+                        const std::vector<std::string> &keys);
+        void createDeferredIndexes();
+
+        // The statement is prepared only the first time and then cached
+        // The returned statement remains owned by the Database
+        sqlite3_stmt * prepareStatement(const std::string &tableName,
+                                        const std::string &placeholders);
+
+        // Any other statement, cached in the same way
+        sqlite3_stmt * prepareSql(const std::string &sql);
+
+        // No copy is made: the text must stay valid until runStatement()
+        void bindText(sqlite3_stmt * statement,
+                      int pos,
+                      std::string_view text);
+
+        // The Database takes ownership of the buffer until runStatement()
+        void bindText(sqlite3_stmt * statement,
+                      int pos,
+                      std::string &&text);
+
+        void bindText(sqlite3_stmt * statement,
+                      int pos,
+                      const char *text);
+
+        void bindInt(sqlite3_stmt * statement,
+                     int pos,
+                     sqlite3_int64 value);
+
+        void runStatement(const std::string &tableName,
+                          sqlite3_stmt * statement);
+
+        void insertInto(const std::string &tableName,
+                        const std::string &keys,
+                        const std::string &values);
+
+        void beginBulkLoad(unsigned int batchSize = BULK_LOAD_BATCH_SIZE);
+        void endBulkLoad();
+
+        void close();
+
+        // Replace the contents with those of filename
+        bool restore();
+
+        // Close the database and atomically replace filename with it
+        bool publish();
+
+        void setSchemaMode(SchemaMode mode) { schemaMode = mode; }
+        SchemaMode getSchemaMode() const { return schemaMode; }
+
+        void setFullText(bool f) { fullText = f; }
+        bool isFullText() const { return fullText; }
+
+        // Rows are being updated in a database restored from the previous run
+        void setIncremental(bool i) { incremental = i; }
+        bool isIncremental() const { return incremental; }
+
+    private:
+        struct deferredIndex {
+            std::string tableName;
+            std::string prefix;
+            std::vector<std::string> keys;
+        };
+
+        sqlite3_stmt * prepare(const std::string &sql);
+
+        sqlite3 *db;
+        std::string filename;
+        bool inMemory;
+
+        // key is table name and placeholders
+        std::map<std::string, sqlite3_stmt *> statementMap;
+
+        // Text moved into bindText(), released after the row has been written
+        // A deque because its elements never move once added
+        std::map<sqlite3_stmt *, std::deque<std::string>> boundTextMap;
+
+        std::vector<deferredIndex> deferredIndexVec;
+
+        SchemaMode schemaMode;
+        bool fullText;
+        bool incremental;
+
+        // Bulk-load mode
+        bool bulkLoad;
+        unsigned int bulkBatchSize;
+        unsigned int bulkRowsInBatch;
+    };
+
+    // One row of the packages table
+    struct PackageRow {
+        std::string gtin;
+        std::string phar;
+        std::string dosage;
+        std::string units;
+        std::string efp;
+        std::string pp;
+        std::string flags;
+    };
+
+    // One row of amikodb, in column order
+    struct AmikoRow {
+        std::string title;
+        std::string auth;
+        std::string atc;
+        std::string substances;
+        std::string regnrs;
+        std::string atcClass;
+        std::string tindex;
+        std::string application;
+        std::string indications;
+        std::string customerId;
+        std::string packInfo;
+        std::string addInfo;
+        std::string ids;
+        std::string titles;
+        std::string content;
+        std::string packages;
+
+        // Same packages, for the packages table
+        std::vector<PackageRow> packageRows;
+
+        // To find the row in the next incremental run
+        std::string key;
+        std::string hash;
+    };
+
+    struct AmikoHash {
+        sqlite3_int64 id;
+        std::string hash;
+    };
+
+    class Hash
+    {
+    public:
+        void add(std::string_view data);
+        std::string str() const;
+
+    private:
+        unsigned long long value = 0xcbf29ce484222325ULL;
+    };
+
+    // One row of productdb
+    struct ProductRow {
+        std::string title;
+        std::string author;
+        std::string eancodes;
+        std::string packInfo;
+        std::string packages;
+    };
+
+    // Define the amiko tables
+    // With fullText an FTS5 index amikodb_fts is created as well
+    void createDB(Database &db,
+                  SchemaMode mode = SchemaMode::single,
+                  bool fullText = true);
+
+    bool reopenDB(Database &db,
+                  SchemaMode mode,
+                  bool fullText);
+
+    // Write one row in the table(s) of the schema mode given to createDB()
+    // and its packages in the packages table
+    // With rowId 0 a new _id is assigned
+    // Returns the _id of the row
+    sqlite3_int64 insertAmiko(Database &db,
+                              AmikoRow &&row,
+                              sqlite3_int64 rowId = 0);
+    void deleteAmiko(Database &db, sqlite3_int64 rowId);
+
+    // key -> _id and hash of the rows of the previous run
+    std::map<std::string, AmikoHash> getAmikoHashes(Database &db);
+
+    std::string getBuildInfo(Database &db, const std::string &name);
+    void setBuildInfo(Database &db,
+                      const std::string &name,
+                      const std::string &value);
+
+    void insertProduct(Database &db, ProductRow &&row);
+
+    std::string htmlToText(std::string_view html);
+
+    void finalizeDB(Database &db,
+                    bool vacuum,
+                    int pageSize);
 }
 
 #endif /* sqlDatabase_hpp */
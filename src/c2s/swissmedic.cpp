@@ -8,6 +8,9 @@
 //
 
 #include <iostream>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 #include <libgen.h>     // for basename()
 #include <regex>
 #include <boost/algorithm/string.hpp>
@@ -19,9 +22,11 @@
 #include "bag.hpp"
 #include "beautify.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 #define COLUMN_A        0   // GTIN (5 digits)
 #define COLUMN_C        2   // name
+#define COLUMN_D        3   // owner
 #define COLUMN_G        6   // ATC
 #define COLUMN_K       10   // packaging code (3 digits)
 #define COLUMN_L       11   // number for dosage
@@ -34,25 +39,32 @@
 
 namespace SWISSMEDIC
 {
-    std::vector< std::vector<std::string> > theWholeSpreadSheet;
+    // One vector per column used, all indexed by row
     std::vector<std::string> regnrs;        // padded to 5 characters (digits)
     std::vector<std::string> packingCode;   // padded to 3 characters (digits)
     std::vector<std::string> gtin;
-    std::string fromSwissmedic("ev.nn.i.H.");
-    
-    // TODO: change it to a map for better performance
+    std::vector<std::string> nameVec;
+    std::vector<std::string> ownerVec;
+    std::vector<std::string> atcVec;
+    std::vector<std::string> applicationVec;
     std::vector<std::string> categoryVec;
-
-    // TODO: change them to a map for better performance
     std::vector<dosageUnits> duVec;
+    const std::string fromSwissmedic("ev.nn.i.H.");
+
+    // Indexes built by parseXLXS(), read-only afterwards
+    // The rows of a regnr, in sheet order. They are usually adjacent,
+    // but that is not guaranteed by the file
+    std::unordered_map<std::string, std::vector<size_t>> regnrRowsMap;
+    std::unordered_map<std::string, size_t> gtinRowMap;    // first row with the GTIN
+    std::unordered_set<std::string> gtin12Set;              // without checksum
 
     // Parse-phase stats
 
     // Usage stats
-    unsigned int statsAugmentedRegnCount = 0;
-    unsigned int statsAugmentedGtinCount = 0;    
-    unsigned int statsTotalGtinCount = 0;
-    unsigned int statsRecoveredDosage = 0;
+    std::atomic<unsigned int> statsAugmentedRegnCount{0};
+    std::atomic<unsigned int> statsAugmentedGtinCount{0};
+    std::atomic<unsigned int> statsTotalGtinCount{0};
+    std::atomic<unsigned int> statsRecoveredDosage{0};
 
 static
 void printFileStats(const std::string &filename)
@@ -61,7 +73,7 @@ void printFileStats(const std::string &filename)
     //REP::html_p(std::string(basename((char *)filename.c_str())));
     REP::html_p(filename);
     REP::html_start_ul();
-    REP::html_li("rows: " + std::to_string(theWholeSpreadSheet.size()));
+    REP::html_li("rows: " + std::to_string(gtin.size()));
     REP::html_end_ul();
 }
 
@@ -78,7 +90,11 @@ void printUsageStats()
 void parseXLXS(const std::string &filename)
 {
     xlnt::workbook wb;
-    wb.load(filename);
+    {
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        wb.load(stream);
+    }
     auto ws = wb.active_sheet();
 
     std::clog << std::endl << "Reading swissmedic XLSX" << std::endl;
@@ -94,11 +110,12 @@ void parseXLXS(const std::string &filename)
             aSingleRow.push_back(cell.to_string());
         }
 
-        theWholeSpreadSheet.push_back(aSingleRow);
+        size_t rowInt = gtin.size();
 
         // Precalculate padded regnr
         std::string rn5 = GTIN::padToLength(5, aSingleRow[COLUMN_A]);
         regnrs.push_back(rn5);
+        regnrRowsMap[rn5].push_back(rowInt);
 
         // Precalculate padded packing code
         std::string code3 = GTIN::padToLength(3, aSingleRow[COLUMN_K]);
@@ -108,6 +125,13 @@ void parseXLXS(const std::string &filename)
         std::string gtin12 = "7680" + rn5 + code3;
         char checksum = GTIN::getGtin13Checksum(gtin12);
         gtin.push_back(gtin12 + checksum);
+        gtinRowMap.emplace(gtin.back(), rowInt);
+        gtin12Set.insert(gtin12);
+
+        nameVec.push_back(aSingleRow[COLUMN_C]);
+        ownerVec.push_back(aSingleRow[COLUMN_D]);
+        atcVec.push_back(aSingleRow[COLUMN_G]);
+        applicationVec.push_back(aSingleRow[COLUMN_S]);
 
         // Precalculate category
         {
@@ -136,13 +160,19 @@ int getAdditionalNames(const std::string &rn,
 {
     std::set<std::string>::iterator it;
     int countAdded = 0;
+
+    // See RealExpertInfo.java:1544
+    //  "a.H." --> "ev.nn.i.H."
+    //  "p.c." --> "ev.ep.e.c."
+    const std::string from = (language == "fr") ? "ev.ep.e.c." : fromSwissmedic;
     
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++) {
-        std::string rn5 = regnrs[rowInt];
-        if (rn5 != rn)
-            continue;
-        
-        std::string g13 = gtin[rowInt];
+    auto search = regnrRowsMap.find(rn);
+    if (search == regnrRowsMap.end())
+        return 0;
+
+    static const std::regex r(R"(\d+)");
+    for (size_t rowInt : search->second) {
+        const std::string &g13 = gtin[rowInt];
         it = gtinUsedSet.find(g13);
         if (it == gtinUsedSet.end()) { // not found list of used GTINs, we must add the name
             countAdded++;
@@ -153,10 +183,9 @@ int getAdditionalNames(const std::string &rn,
 #ifdef DEBUG_IDENTIFY_NAMES
             onePackageInfo += "swm+";
 #endif
-            onePackageInfo += theWholeSpreadSheet.at(rowInt).at(COLUMN_C);
+            onePackageInfo += nameVec[rowInt];
             BEAUTY::beautifyName(onePackageInfo);
             // Verify presence of dosage
-            std::regex r(R"(\d+)");
             if (!std::regex_search(onePackageInfo, r)) {
                 statsRecoveredDosage++;
                 //std::clog << "no dosage for " << name << std::endl;
@@ -164,19 +193,14 @@ int getAdditionalNames(const std::string &rn,
                 onePackageInfo += " " + duVec[rowInt].units;
             }
 
-            // See RealExpertInfo.java:1544
-            //  "a.H." --> "ev.nn.i.H."
-            //  "p.c." --> "ev.ep.e.c."
-            if (language == "fr")
-                fromSwissmedic = "ev.ep.e.c.";
-
-            std::string paf = BAG::getPricesAndFlags(g13, fromSwissmedic, categoryVec[rowInt]);
+            std::string paf = BAG::getPricesAndFlags(g13, from, categoryVec[rowInt]);
             if (!paf.empty())
                 onePackageInfo += paf;
 
             gtinUsedSet.insert(g13);
             packages.gtin.push_back(g13);
             packages.name.push_back(onePackageInfo);
+            packages.category.push_back(categoryVec[rowInt]);
         }
     }
     
@@ -186,59 +210,60 @@ int getAdditionalNames(const std::string &rn,
     return countAdded;
 }
 
-int countRowsWithRn(const std::string &rn)
+// All the packages, for productdb
+// Those already in gtinUsed are skipped. Usage stats are not affected
+void getProducts(std::set<std::string> &gtinUsed,
+                 GTIN::products &products,
+                 const std::string &language)
 {
-    int count = 0;
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++) {
-        std::string gtin_5 = regnrs[rowInt];
-        // TODO: to speed up do a numerical comparison so that we can return when gtin5>rn
-        // assuming that column A is sorted
-        if (gtin_5 == rn)
-            count++;
-    }
+    static const std::regex r(R"(\d+)");
+    const std::string from = (language == "fr") ? "ev.ep.e.c." : fromSwissmedic;
 
-    return count;
-}
-    
-bool findGtin(const std::string &gtin)
-{
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++) {
-        std::string rn5 = regnrs[rowInt];
-        std::string code3 = packingCode[rowInt];
-        std::string gtin12 = "7680" + rn5 + code3;
+    for (size_t rowInt = 0; rowInt < gtin.size(); rowInt++) {
+        const std::string &g13 = gtin[rowInt];
+        if (gtinUsed.find(g13) != gtinUsed.end())
+            continue;
 
-#if 0
-        // We could also recalculate and verify the checksum
-        // but such verification has already been done when parsing the files
-        char checksum = GTIN::getGtin13Checksum(gtin12);
-        
-        if (checksum != gtin[12]) {
-            std::cerr
-            << basename((char *)__FILE__) << ":" << __LINE__
-            << ", GTIN error, expected:" << checksum
-            << ", received" << gtin[12]
-            << std::endl;
+        std::string name = nameVec[rowInt];
+        BEAUTY::beautifyName(name);
+        if (!std::regex_search(name, r)) {
+            name += " " + duVec[rowInt].dosage;
+            name += " " + duVec[rowInt].units;
         }
-#endif
 
-        // The comparison is only the first 12 digits, without checksum
-        if (gtin12 == gtin.substr(0,12)) // pos, len
-            return true;
+        std::string paf = BAG::getPricesAndFlags(g13, from, categoryVec[rowInt]);
+
+        gtinUsed.insert(g13);
+        products.gtin.push_back(g13);
+        products.name.push_back(name);
+        products.packInfo.push_back(name + paf);
+        products.author.push_back(ownerVec[rowInt]);
+        products.category.push_back(categoryVec[rowInt]);
     }
+}
+
+int countRowsWithRn(const std::string &rn)
+{
+    auto search = regnrRowsMap.find(rn);
+    if (search == regnrRowsMap.end())
+        return 0;
 
-    return false;
+    return search->second.size();
+}
+    
+// The comparison is only the first 12 digits, without checksum
+bool findGtin(const std::string &gtin)
+{
+    return gtin12Set.find(gtin.substr(0,12)) != gtin12Set.end(); // pos, len
 }
 
 std::string getApplication(const std::string &rn)
 {
     std::string app;
 
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++) {
-        if (rn == regnrs[rowInt]) {
-            app = theWholeSpreadSheet.at(rowInt).at(COLUMN_S) + " (Swissmedic)";
-            break;
-        }
-    }
+    auto search = regnrRowsMap.find(rn);
+    if (search != regnrRowsMap.end())
+        app = applicationVec[search->second.front()] + " (Swissmedic)";
 
     return app;
 }
@@ -247,12 +272,9 @@ std::string getAtcFromFirstRn(const std::string &rn)
 {
     std::string atc;
 
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++) {
-        if (rn == regnrs[rowInt]) {
-            atc = theWholeSpreadSheet.at(rowInt).at(COLUMN_G);
-            break;
-        }
-    }
+    auto search = regnrRowsMap.find(rn);
+    if (search != regnrRowsMap.end())
+        atc = atcVec[search->second.front()];
 
     return atc;
 }
@@ -261,24 +283,31 @@ std::string getCategoryByGtin(const std::string &g)
 {
     std::string cat;
 
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++)
-        if (gtin[rowInt] == g) {
-            cat = categoryVec[rowInt];
-            break;
-        }
+    auto search = gtinRowMap.find(g);
+    if (search != gtinRowMap.end())
+        cat = categoryVec[search->second];
 
     return cat;
 }
 
+std::string getOwnerByGtin(const std::string &g)
+{
+    std::string owner;
+
+    auto search = gtinRowMap.find(g);
+    if (search != gtinRowMap.end())
+        owner = ownerVec[search->second];
+
+    return owner;
+}
+
 dosageUnits getByGtin(const std::string &g)
 {
     dosageUnits du;
 
-    for (int rowInt = 0; rowInt < theWholeSpreadSheet.size(); rowInt++)
-        if (gtin[rowInt] == g) {
-            du = duVec[rowInt];
-            break;
-        }
+    auto search = gtinRowMap.find(g);
+    if (search != gtinRowMap.end())
+        du = duVec[search->second];
 
     return du;
 }
@@ -26,12 +26,16 @@ namespace SWISSMEDIC
                            std::set<std::string> &gtinUsed,
                            GTIN::oneFachinfoPackages &packages,
                            const std::string &language);
+    void getProducts(std::set<std::string> &gtinUsed,
+                     GTIN::products &products,
+                     const std::string &language);
     int countRowsWithRn(const std::string &rn);
     std::string getApplication(const std::string &rn);
     std::string getAtcFromFirstRn(const std::string &rn);
 
     bool findGtin(const std::string &gtin);
     std::string getCategoryByGtin(const std::string &gtin);
+    std::string getOwnerByGtin(const std::string &gtin);
     dosageUnits getByGtin(const std::string &gtin);
 
     void printUsageStats();
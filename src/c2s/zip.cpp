@@ -0,0 +1,298 @@
+//
+//  zip.cpp
+//  cpp2sqlite
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <zlib.h>
+#include <libgen.h>     // for basename()
+#include <fcntl.h>      // for open()
+#include <unistd.h>     // for pread()
+#include <sys/stat.h>
+
+#include "zip.hpp"
+#include "parallel.hpp"
+#include "report.hpp"
+
+// Back-reference window of deflate
+#define DICTIONARY_SIZE     (32 * 1024)
+
+// Without the zip64 extension sizes and offsets are 32 bits
+#define ZIP_MAX_SIZE        0xFFFFFFFFULL
+
+namespace ZIP
+{
+    struct compressedBlock {
+        std::string data;
+        uLong crc = 0;
+        size_t length = 0;      // uncompressed
+        bool ok = true;
+    };
+
+static void put16(std::string &s, unsigned int v)
+{
+    s += (char)(v & 0xFF);
+    s += (char)((v >> 8) & 0xFF);
+}
+
+static void put32(std::string &s, unsigned long v)
+{
+    put16(s, v & 0xFFFF);
+    put16(s, (v >> 16) & 0xFFFF);
+}
+
+// MS-DOS format, as used in the zip headers
+static void getDosTime(time_t t, unsigned int &dosTime, unsigned int &dosDate)
+{
+    struct tm lt;
+    localtime_r(&t, &lt);
+    if (lt.tm_year < 80) {
+        dosTime = 0;
+        dosDate = (1 << 5) | 1;     // 1 Jan 1980
+        return;
+    }
+
+    dosTime = (lt.tm_hour << 11) | (lt.tm_min << 5) | (lt.tm_sec / 2);
+    dosDate = ((lt.tm_year - 80) << 9) | ((lt.tm_mon + 1) << 5) | lt.tm_mday;
+}
+
+// Raw deflate of block i, ending on a byte boundary so that the blocks
+// can be concatenated. Only the last block ends the stream.
+static compressedBlock compressBlock(int fd,
+                                     unsigned long long fileSize,
+                                     size_t i,
+                                     size_t blockCount)
+{
+    compressedBlock block;
+
+    unsigned long long start = (unsigned long long)i * ZIP_BLOCK_SIZE;
+    block.length = (size_t)std::min<unsigned long long>(ZIP_BLOCK_SIZE, fileSize - start);
+    size_t dictionaryLength = (size_t)std::min<unsigned long long>(DICTIONARY_SIZE, start);
+
+    std::string input(dictionaryLength + block.length, '\0');
+    size_t done = 0;
+    while (done < input.size()) {
+        ssize_t n = pread(fd, &input[done], input.size() - done, start - dictionaryLength + done);
+        if (n <= 0) {
+            std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error reading block " << i << std::endl;
+            block.ok = false;
+            return block;
+        }
+
+        done += n;
+    }
+
+    Bytef *data = (Bytef *)&input[dictionaryLength];
+    block.crc = crc32(0L, data, block.length);
+
+    z_stream strm {};
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", deflateInit2 failed" << std::endl;
+        block.ok = false;
+        return block;
+    }
+
+    // So that matches can refer to the previous block, as in a single stream
+    if (dictionaryLength > 0)
+        deflateSetDictionary(&strm, (Bytef *)&input[0], dictionaryLength);
+
+    int flush = (i + 1 == blockCount) ? Z_FINISH : Z_SYNC_FLUSH;
+    block.data.resize(deflateBound(&strm, block.length) + 16);
+    strm.next_in = data;
+    strm.avail_in = block.length;
+    size_t produced = 0;
+    int rc;
+    for (;;) {
+        strm.next_out = (Bytef *)&block.data[produced];
+        strm.avail_out = block.data.size() - produced;
+        rc = deflate(&strm, flush);
+        produced = block.data.size() - strm.avail_out;
+        if (rc == Z_STREAM_ERROR)
+            break;
+
+        // Output space left means the flush is complete
+        if ((flush == Z_FINISH) ? (rc == Z_STREAM_END) : (strm.avail_out > 0))
+            break;
+
+        block.data.resize(block.data.size() * 2);
+    }
+
+    deflateEnd(&strm);
+    if (rc == Z_STREAM_ERROR) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", deflate failed, block " << i << std::endl;
+        block.ok = false;
+    }
+
+    block.data.resize(produced);
+    return block;
+}
+
+bool zipFile(const std::string &filename,
+             const std::string &zipFilename,
+             unsigned int jobs,
+             Stats &stats)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error opening " << filename << std::endl;
+        if (fd >= 0)
+            close(fd);
+
+        return false;
+    }
+
+    unsigned long long fileSize = st.st_size;
+    if (fileSize >= ZIP_MAX_SIZE) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", " << filename << " is too big for zip without zip64" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    std::string entryName = filename.substr(filename.find_last_of('/') + 1);
+    unsigned int dosTime, dosDate;
+    getDosTime(st.st_mtime, dosTime, dosDate);
+
+    const std::string workFilename = zipFilename + ".tmp";
+    std::ofstream ofs(workFilename, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error creating " << workFilename << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // Local file header, CRC and sizes are filled in at the end
+    std::string header;
+    put32(header, 0x04034b50);
+    put16(header, 20);              // version needed to extract: deflate
+    put16(header, 0);               // flags
+    put16(header, Z_DEFLATED);      // method
+    put16(header, dosTime);
+    put16(header, dosDate);
+    const size_t crcOffset = header.size();
+    put32(header, 0);               // CRC-32
+    put32(header, 0);               // compressed size
+    put32(header, 0);               // uncompressed size
+    put16(header, entryName.size());
+    put16(header, 0);               // extra field length
+    header += entryName;
+    ofs.write(header.data(), header.size());
+
+    // An empty file still needs one final deflate block
+    size_t blockCount = (fileSize + ZIP_BLOCK_SIZE - 1) / ZIP_BLOCK_SIZE;
+    if (blockCount == 0)
+        blockCount = 1;
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    unsigned long long compressedSize = 0;
+    bool ok = true;
+    PAR::orderedForEach<compressedBlock>(blockCount, jobs, 4 * jobs,
+        [&](size_t i) {
+            return compressBlock(fd, fileSize, i, blockCount);
+        },
+        [&](size_t, compressedBlock &&block) {
+            ok = ok && block.ok;
+            crc = crc32_combine(crc, block.crc, block.length);
+            compressedSize += block.data.size();
+            ofs.write(block.data.data(), block.data.size());
+        });
+
+    close(fd);
+
+    if (compressedSize >= ZIP_MAX_SIZE) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", " << zipFilename << " is too big for zip without zip64" << std::endl;
+        ok = false;
+    }
+
+    std::string sizes;
+    put32(sizes, crc);
+    put32(sizes, compressedSize);
+    put32(sizes, fileSize);
+
+    // Central directory, one entry
+    unsigned long long centralOffset = header.size() + compressedSize;
+    std::string central;
+    put32(central, 0x02014b50);
+    put16(central, (3 << 8) | 20);  // version made by: unix
+    put16(central, 20);
+    put16(central, 0);
+    put16(central, Z_DEFLATED);
+    put16(central, dosTime);
+    put16(central, dosDate);
+    central += sizes;
+    put16(central, entryName.size());
+    put16(central, 0);              // extra field length
+    put16(central, 0);              // comment length
+    put16(central, 0);              // disk number
+    put16(central, 0);              // internal attributes
+    put32(central, (unsigned long)(st.st_mode & 0xFFFF) << 16);    // external attributes
+    put32(central, 0);              // offset of the local header
+    central += entryName;
+
+    // End of central directory
+    std::string end;
+    put32(end, 0x06054b50);
+    put16(end, 0);
+    put16(end, 0);
+    put16(end, 1);                  // entries on this disk
+    put16(end, 1);                  // entries
+    put32(end, central.size());
+    put32(end, centralOffset);
+    put16(end, 0);                  // comment length
+
+    ofs.write(central.data(), central.size());
+    ofs.write(end.data(), end.size());
+    ofs.seekp(crcOffset);
+    ofs.write(sizes.data(), sizes.size());
+    ofs.close();
+
+    if (!ofs || !ok) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error writing " << workFilename << std::endl;
+        std::remove(workFilename.c_str());
+        return false;
+    }
+
+    if (std::rename(workFilename.c_str(), zipFilename.c_str()) != 0) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", cannot rename " << workFilename << " to " << zipFilename << std::endl;
+        return false;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    stats.bytesIn = fileSize;
+    stats.bytesOut = centralOffset + central.size() + end.size();
+    stats.blocks = blockCount;
+    stats.seconds = elapsed.count();
+    return true;
+}
+
+void printStats(const std::string &zipFilename, unsigned int jobs, const Stats &stats)
+{
+    std::ostringstream ratio;
+    ratio << std::fixed << std::setprecision(1)
+          << ((stats.bytesIn > 0) ? 100.0 * stats.bytesOut / stats.bytesIn : 0) << " %";
+    std::ostringstream time;
+    time << std::fixed << std::setprecision(3) << stats.seconds << " s";
+
+    REP::html_h2("zip");
+    REP::html_p(zipFilename);
+    REP::html_start_ul();
+    REP::html_li("size: " + std::to_string(stats.bytesIn / 1024) + " KB -> " +
+                 std::to_string(stats.bytesOut / 1024) + " KB (" + ratio.str() + ")");
+    REP::html_li("blocks: " + std::to_string(stats.blocks) + " on " + std::to_string(jobs) + " threads");
+    REP::html_li("time: " + time.str());
+    REP::html_end_ul();
+}
+
+}
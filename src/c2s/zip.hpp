@@ -0,0 +1,40 @@
+//
+//  zip.hpp
+//  cpp2sqlite
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#ifndef zip_hpp
+#define zip_hpp
+
+#include <string>
+
+// Bytes of the input compressed by one thread at a time
+#define ZIP_BLOCK_SIZE      (128 * 1024)
+
+namespace ZIP
+{
+    struct Stats {
+        unsigned long long bytesIn = 0;
+        unsigned long long bytesOut = 0;
+        size_t blocks = 0;
+        double seconds = 0;
+    };
+
+    // Write zipFilename, an archive with the single entry 'filename'.
+    // The blocks of the file are deflated independently on 'jobs' threads,
+    // each primed with the end of the previous block, and concatenated
+    // into one deflate stream, as pigz does.
+    // Like the database, the archive is written to a work file that is
+    // renamed when complete.
+    bool zipFile(const std::string &filename,
+                 const std::string &zipFilename,
+                 unsigned int jobs,
+                 Stats &stats);
+
+    void printStats(const std::string &zipFilename, unsigned int jobs, const Stats &stats);
+}
+
+#endif /* zip_hpp */
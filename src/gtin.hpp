@@ -21,6 +21,17 @@ namespace GTIN
     {
         std::vector<std::string> name;
         std::vector<std::string> gtin;
+        std::vector<std::string> category;  // as given to BAG::getPricesAndFlags()
+    };
+
+    // Packages known to the sources, with or without Fachinfo
+    struct products
+    {
+        std::vector<std::string> gtin;
+        std::vector<std::string> name;
+        std::vector<std::string> packInfo;  // name with prices and flags
+        std::vector<std::string> author;    // might be empty
+        std::vector<std::string> category;  // as given to BAG::getPricesAndFlags()
     };
 
     char getGtin13Checksum(std::string gtin12);
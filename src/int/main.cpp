@@ -9,6 +9,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <set>
@@ -17,10 +18,11 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
-#include <boost/algorithm/string_regex.hpp>
+#include <boost/algorithm/string.hpp>
 
 #include "config.h"
 #include "atc.hpp"
+#include "parallel.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "lang/en.h"    // Base language
@@ -30,6 +32,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 #define OUTPUT_FILE_SEPARATOR   "|"
 
+// Bytes of matrix.csv converted by one thread at a time, extended to the end of a line
+#define CSV_CHUNK_SIZE          (256 * 1024)
+
 #define inColumnA     columnTrimmedVector[0] // ATC1
 #define inColumnB     columnTrimmedVector[1] // Name1
 #define inColumnC     columnTrimmedVector[2] // ATC2
@@ -58,7 +63,7 @@ void on_version()
     std::cout << "C++ " << __cplusplus << std::endl;
 }
 
-void outputInteraction(std::ofstream &ofs,
+void outputInteraction(std::ostream &ofs,
                        const std::vector<std::string> &columnTrimmedVector)
 {
     if (columnTrimmedVector.size() != 9) {
@@ -93,7 +98,7 @@ void outputInteraction(std::ofstream &ofs,
     << inColumnC << OUTPUT_FILE_SEPARATOR   // C
     << OUTPUT_FILE_SEPARATOR                // D empty column
     << outColumnE                           // E
-    << std::endl;
+    << "\n";
 }
 
 // Define translatedMap
@@ -125,74 +130,149 @@ void getTranslationMap(const std::string &dir,
     }
 }
 
+struct csvChunk {
+    std::string text;
+    std::set<std::string> toBeTranslated;
+    std::string error;      // the first line that can't be converted
+};
+
+// Empty if there is no translation, without adding it to translatedMap,
+// which is shared by the threads
+static const std::string & getTranslation(const std::string &key)
+{
+    static const std::string empty;
+    auto search = translatedMap.find(key);
+    if (search == translatedMap.end())
+        return empty;
+
+    return search->second;
+}
+
+// The lines of one chunk of matrix.csv
+// Only reads the global data, so that several chunks can be converted at the same time
+static csvChunk convertLines(const std::string &csv,
+                             size_t begin,
+                             size_t end,
+                             const std::string &language)
+{
+    csvChunk chunk;
+    std::ostringstream ofs;
+
+    while (begin < end) {
+        size_t eol = csv.find('\n', begin);
+        if ((eol == std::string::npos) || (eol > end))
+            eol = end;
+
+        std::string str = csv.substr(begin, eol - begin);
+        begin = eol + 1;
+
+        std::vector<std::string> columnVector;
+        std::vector<std::string> columnTrimmedVector;
+        //boost::algorithm::split(interVector, str, boost::is_any_of("\","), boost::token_compress_on);
+        // Same as split_regex with "\",", without a regex
+        boost::algorithm::iter_split(columnVector, str, boost::algorithm::first_finder("\","));
+
+        if (columnVector.size() != 9) {
+            chunk.error = "Unexpected # columns: " + std::to_string(columnVector.size());
+            break;
+        }
+
+        for (auto s : columnVector) {
+            boost::algorithm::trim_left_if(s, boost::is_any_of("\""));
+            boost::algorithm::trim_right_if(s, boost::is_any_of("\""));
+            columnTrimmedVector.push_back(s);
+        }
+
+        if (language == "de") {
+            outputInteraction(ofs, columnTrimmedVector);
+
+            chunk.toBeTranslated.insert(inColumnE);
+            chunk.toBeTranslated.insert(inColumnF);
+            chunk.toBeTranslated.insert(inColumnH);
+        }
+        else {
+            std::vector<std::string> translatedVector;
+            
+            translatedVector.push_back(inColumnA);
+            translatedVector.push_back(ATC::getTextByAtc(inColumnA));
+            translatedVector.push_back(inColumnC);
+            translatedVector.push_back(ATC::getTextByAtc(inColumnC));
+            translatedVector.push_back(getTranslation(inColumnE));
+            translatedVector.push_back(getTranslation(inColumnF));
+            translatedVector.push_back(inColumnG);
+            translatedVector.push_back(getTranslation(inColumnH));
+            translatedVector.push_back(inColumnI);
+
+            outputInteraction(ofs, translatedVector);
+        }
+    }
+
+    chunk.text = ofs.str();
+    return chunk;
+}
+
+// The file is read at once and cut into chunks at line boundaries,
+// the chunks are converted on 'jobs' threads and written in order
 void parseCSV(const std::string &inFilename,
               const std::string &outDir,
               const std::string &language,
+              unsigned int jobs,
               bool verbose)
 {
-    std::ofstream ofs;
-    ofs.open(outDir + "/drug_interactions_csv_" + language + ".csv");
-
-    try {
+    std::string csv;
+    {
         //std::clog << std::endl << "Reading CSV" << std::endl;
-        std::ifstream file(inFilename);
-        
-        std::string str;
-        bool header = true;
-        while (std::getline(file, str)) {
-            
-            if (header) {
-                header = false;
-                continue;
-            }
-            
-            std::vector<std::string> columnVector;
-            std::vector<std::string> columnTrimmedVector;
-            //boost::algorithm::split(interVector, str, boost::is_any_of("\","), boost::token_compress_on);
-            boost::algorithm::split_regex( columnVector, str, boost::regex( "\"," ));
+        std::ifstream file(inFilename, std::ios::binary);
+        if (!file) {
+            std::cerr
+            << basename((char *)__FILE__) << ":" << __LINE__
+            << " Error opening " << inFilename
+            << std::endl;
+            return;
+        }
 
-            if (columnVector.size() != 9) {
-                std::clog << "Unexpected # columns: " << columnVector.size() << std::endl;
-                exit(EXIT_FAILURE);
-            }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        csv = contents.str();
+    }
 
-            for (auto s : columnVector) {
-                boost::algorithm::trim_left_if(s, boost::is_any_of("\""));
-                boost::algorithm::trim_right_if(s, boost::is_any_of("\""));
-                columnTrimmedVector.push_back(s);
-            }
+    // Skip the header
+    size_t dataStart = csv.find('\n');
+    dataStart = (dataStart == std::string::npos) ? csv.size() : dataStart + 1;
 
-            if (language == "de") {
-                outputInteraction(ofs, columnTrimmedVector);
+    // Like getline(), a last line without '\n' still counts, a last '\n' doesn't start a line
+    size_t dataEnd = csv.size();
+    if ((dataEnd > dataStart) && (csv[dataEnd - 1] == '\n'))
+        dataEnd--;
 
-                toBeTranslatedSet.insert(inColumnE);
-                toBeTranslatedSet.insert(inColumnF);
-                toBeTranslatedSet.insert(inColumnH);
-            }
-            else {
-                std::vector<std::string> translatedVector;
-                
-                translatedVector.push_back(inColumnA);
-                translatedVector.push_back(ATC::getTextByAtc(inColumnA));
-                translatedVector.push_back(inColumnC);
-                translatedVector.push_back(ATC::getTextByAtc(inColumnC));
-                translatedVector.push_back(translatedMap[inColumnE]);
-                translatedVector.push_back(translatedMap[inColumnF]);
-                translatedVector.push_back(inColumnG);
-                translatedVector.push_back(translatedMap[inColumnH]);
-                translatedVector.push_back(inColumnI);
-
-                outputInteraction(ofs, translatedVector);
-            }
-        }
+    std::vector<size_t> chunkStarts;
+    for (size_t pos = dataStart; pos < dataEnd; ) {
+        chunkStarts.push_back(pos);
+        size_t eol = csv.find('\n', std::min(pos + CSV_CHUNK_SIZE, dataEnd));
+        pos = (eol == std::string::npos) ? dataEnd : eol + 1;
     }
-    catch (std::exception &e) {
-        std::cerr
-        << basename((char *)__FILE__) << ":" << __LINE__
-        << " Error " << e.what()
-        << std::endl;
-    }
-    
+
+    chunkStarts.push_back(dataEnd + 1);
+
+    std::string out;
+    out.reserve(csv.size() * 2);
+    PAR::orderedForEach<csvChunk>(chunkStarts.size() - 1, jobs, 4 * jobs,
+        [&](size_t i) {
+            return convertLines(csv, chunkStarts[i], chunkStarts[i+1] - 1, language);
+        },
+        [&](size_t, csvChunk &&chunk) {
+            if (!chunk.error.empty()) {
+                std::clog << chunk.error << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            out += chunk.text;
+            toBeTranslatedSet.insert(chunk.toBeTranslated.begin(), chunk.toBeTranslated.end());
+        });
+
+    std::ofstream ofs;
+    ofs.open(outDir + "/drug_interactions_csv_" + language + ".csv");
+    ofs.write(out.data(), out.size());
     ofs.close();
 }
 
@@ -204,6 +284,7 @@ int main(int argc, char **argv)
     std::string opt_workDirectory;  // for downloads subdirectory
     std::string opt_language;
     bool flagVerbose = false;
+    unsigned int opt_jobs = 0;
 
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -211,6 +292,7 @@ int main(int argc, char **argv)
         ("version,v", "print the version information and exit")
         ("verbose", "be extra verbose") // Show errors and logs
         ("lang", po::value<std::string>( &opt_language )->default_value("de"), "use given language (de/fr)")
+        ("jobs", po::value<unsigned int>( &opt_jobs )->default_value(0), "number of threads converting matrix.csv, 0 for one per core")
         ("inDir", po::value<std::string>( &opt_inputDirectory )->required(), "input directory") //  without trailing '/'
         ("workDir", po::value<std::string>( &opt_workDirectory ), "parent of 'downloads' and 'output' directories, default as parent of inDir ")
         ;
@@ -250,6 +332,9 @@ int main(int argc, char **argv)
         flagVerbose = true;
     }
     
+    if (opt_jobs == 0)
+        opt_jobs = PAR::defaultJobs();
+
     if (!vm.count("workDir")) {
         opt_workDirectory = opt_inputDirectory + "/..";
     }
@@ -272,6 +357,7 @@ int main(int argc, char **argv)
     parseCSV(opt_inputDirectory + "/matrix.csv",
              opt_workDirectory + "/output",
              opt_language,
+             opt_jobs,
              false);
 
     if (opt_language == "de") {
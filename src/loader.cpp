@@ -0,0 +1,203 @@
+//
+//  loader.cpp
+//  cpp2sqlite, pharma
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>     // for basename()
+
+#include "loader.hpp"
+#include "report.hpp"
+
+namespace LOADER
+{
+    struct prefetchedFile {
+        bool done = false;
+        Buffer buffer;
+    };
+
+    // key is filename
+    std::map<std::string, prefetchedFile> prefetchedMap;
+    std::mutex mutex;
+    std::condition_variable fileRead;
+
+    // Stats
+    unsigned int statsFilesPrefetched = 0;
+    unsigned int statsFilesNotPrefetched = 0;
+    unsigned int statsFilesReadAhead = 0;
+    unsigned long long statsBytesPrefetched = 0;
+    double statsReadSeconds = 0;    // background thread
+    double statsWaitSeconds = 0;    // parsers waiting for it
+
+    // Joined at exit, after everything above is still valid
+    struct backgroundThread {
+        std::thread thread;
+        ~backgroundThread() {
+            if (thread.joinable())
+                thread.join();
+        }
+    } reader;
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static Buffer readFile(const std::string &filename)
+{
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error opening " << filename << std::endl;
+        return std::make_shared<const std::string>();
+    }
+
+    std::streamsize size = ifs.tellg();
+    ifs.seekg(0);
+
+    std::shared_ptr<std::string> contents = std::make_shared<std::string>(size, '\0');
+    if (!ifs.read(&(*contents)[0], size)) {
+        std::cerr << basename((char *)__FILE__) << ":" << __LINE__ << ", Error reading " << filename << std::endl;
+        contents->resize(ifs.gcount());
+    }
+
+    return contents;
+}
+
+void prefetch(const std::vector<std::string> &filenames)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto f : filenames)
+            prefetchedMap[f];
+    }
+
+    reader.thread = std::thread([filenames] {
+        for (auto f : filenames) {
+            auto start = std::chrono::steady_clock::now();
+            Buffer buffer = readFile(f);
+            double seconds = secondsSince(start);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                prefetchedMap[f].buffer = buffer;
+                prefetchedMap[f].done = true;
+                statsFilesPrefetched++;
+                statsBytesPrefetched += buffer->size();
+                statsReadSeconds += seconds;
+            }
+
+            fileRead.notify_all();
+        }
+    });
+}
+
+void readAhead(const std::string &filename)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;     // the parser will report it
+
+    // Returns at once, the system reads the file in the background
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    statsFilesReadAhead++;
+#endif
+}
+
+Buffer take(const std::string &filename)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto search = prefetchedMap.find(filename);
+    if (search == prefetchedMap.end()) {
+        statsFilesNotPrefetched++;
+        lock.unlock();
+        return readFile(filename);
+    }
+
+    if (!search->second.done) {
+        auto start = std::chrono::steady_clock::now();
+        fileRead.wait(lock, [&] { return search->second.done; });
+        statsWaitSeconds += secondsSince(start);
+    }
+
+    Buffer buffer = search->second.buffer;
+    prefetchedMap.erase(search);
+    return buffer;
+}
+
+BufferStream::MemoryBuf::MemoryBuf(const std::string &buffer)
+{
+    // The get area is never written to
+    char *begin = const_cast<char *>(buffer.data());
+    setg(begin, begin, begin + buffer.size());
+}
+
+std::streambuf::pos_type BufferStream::MemoryBuf::seekoff(off_type off,
+                                                          std::ios_base::seekdir dir,
+                                                          std::ios_base::openmode /*which*/)
+{
+    char *pos = gptr();
+    if (dir == std::ios_base::beg)
+        pos = eback() + off;
+    else if (dir == std::ios_base::end)
+        pos = egptr() + off;
+    else
+        pos = gptr() + off;
+
+    if ((pos < eback()) || (pos > egptr()))
+        return pos_type(off_type(-1));
+
+    setg(eback(), pos, egptr());
+    return pos_type(pos - eback());
+}
+
+std::streambuf::pos_type BufferStream::MemoryBuf::seekpos(pos_type pos,
+                                                          std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+BufferStream::BufferStream(const std::string &buffer)
+: std::istream(nullptr)
+, buf(buffer)
+{
+    rdbuf(&buf);
+}
+
+void printFileStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::ostringstream readSeconds;
+    readSeconds << std::fixed << std::setprecision(3) << statsReadSeconds;
+    std::ostringstream waitSeconds;
+    waitSeconds << std::fixed << std::setprecision(3) << statsWaitSeconds;
+
+    REP::html_h2("Read-ahead");
+    REP::html_start_ul();
+    REP::html_li("prefetched: " + std::to_string(statsFilesPrefetched) + " files, " +
+                 std::to_string(statsBytesPrefetched / (1024 * 1024)) + " MB in " + readSeconds.str() + " s");
+    REP::html_li("parsers waiting for them: " + waitSeconds.str() + " s");
+    REP::html_li("read ahead by the system: " + std::to_string(statsFilesReadAhead) + " files");
+    REP::html_li("not prefetched: " + std::to_string(statsFilesNotPrefetched) + " files");
+    REP::html_end_ul();
+}
+
+}
@@ -0,0 +1,63 @@
+//
+//  loader.hpp
+//  cpp2sqlite, pharma
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#ifndef loader_hpp
+#define loader_hpp
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <istream>
+#include <streambuf>
+
+namespace LOADER
+{
+    typedef std::shared_ptr<const std::string> Buffer;
+
+    // Start reading the files into memory on a background thread, in this order,
+    // so that the disk is busy while the parsers are
+    // Call it once, before the parsers start
+    void prefetch(const std::vector<std::string> &filenames);
+
+    // Ask the system to read the file ahead into its cache,
+    // for a file too big to be kept in memory, which is then read as a stream
+    void readAhead(const std::string &filename);
+
+    // The contents of the file, waiting for the background thread if necessary,
+    // or read now if it was not prefetched.
+    // Empty if the file can't be read.
+    // The loader doesn't keep the buffer after this.
+    Buffer take(const std::string &filename);
+
+    // Reads a buffer in place, for parsers that take an istream
+    class BufferStream : public std::istream
+    {
+    public:
+        explicit BufferStream(const std::string &buffer);
+
+    private:
+        class MemoryBuf : public std::streambuf
+        {
+        public:
+            explicit MemoryBuf(const std::string &buffer);
+
+        protected:
+            pos_type seekoff(off_type off,
+                             std::ios_base::seekdir dir,
+                             std::ios_base::openmode which) override;
+            pos_type seekpos(pos_type pos,
+                             std::ios_base::openmode which) override;
+        };
+
+        MemoryBuf buf;
+    };
+
+    void printFileStats();
+}
+
+#endif /* loader_hpp */
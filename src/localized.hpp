@@ -0,0 +1,55 @@
+//
+//  localized.hpp
+//  cpp2sqlite, pharma
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#ifndef localized_hpp
+#define localized_hpp
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace LOC
+{
+    // The same text in each of the languages being built, key is the language
+    // so that a source file is read only once for all the databases
+    typedef std::map<std::string, std::string> Text;
+
+    // Empty if the language was not loaded
+    inline const std::string & get(const Text &text, const std::string &language)
+    {
+        static const std::string empty;
+        auto search = text.find(language);
+        if (search == text.end())
+            return empty;
+
+        return search->second;
+    }
+
+    // "de,fr" -> {"de", "fr"}, without duplicates
+    inline std::vector<std::string> split(const std::string &languages)
+    {
+        std::vector<std::string> v;
+        std::string::size_type start = 0;
+        while (start <= languages.size()) {
+            std::string::size_type end = languages.find(',', start);
+            if (end == std::string::npos)
+                end = languages.size();
+
+            if ((end > start) &&
+                (std::find(v.begin(), v.end(), languages.substr(start, end - start)) == v.end()))
+                v.push_back(languages.substr(start, end - start));
+
+            start = end + 1;
+        }
+
+        return v;
+    }
+}
+
+#endif /* localized_hpp */
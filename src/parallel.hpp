@@ -0,0 +1,422 @@
+//
+//  parallel.hpp
+//  cpp2sqlite, pharma, interaction
+//
+//  ©ywesee GmbH -- all rights reserved
+//  License GPLv3.0 -- see License File
+//
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <atomic>
+#include <libgen.h>     // for basename()
+
+namespace PAR
+{
+    // Number of threads for "--jobs 0"
+    inline unsigned int defaultJobs()
+    {
+        unsigned int n = std::thread::hardware_concurrency();
+        return (n > 0) ? n : 1;
+    }
+
+    // Call work(i) for each i in [0, n) on 'jobs' threads, and deliver(i, result)
+    // on the calling thread in increasing order of i, as soon as it's available.
+    // At most 'window' results are kept waiting, so memory stays bounded.
+    //
+    // With jobs <= 1 everything runs on the calling thread, in order.
+    template <typename T, typename Work, typename Deliver>
+    void orderedForEach(size_t n,
+                        unsigned int jobs,
+                        size_t window,
+                        Work work,
+                        Deliver deliver)
+    {
+        if (jobs <= 1) {
+            for (size_t i = 0; i < n; i++)
+                deliver(i, work(i));
+
+            return;
+        }
+
+        if (window < jobs)
+            window = jobs;
+
+        std::vector<std::optional<T>> slots(window);
+        std::mutex mutex;
+        std::condition_variable resultReady;
+        std::condition_variable slotFree;
+        size_t nextToClaim = 0;
+        size_t nextToDeliver = 0;
+
+        auto worker = [&]() {
+            for (;;) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slotFree.wait(lock, [&] {
+                        return (nextToClaim >= n) || (nextToClaim < nextToDeliver + window);
+                    });
+
+                    if (nextToClaim >= n)
+                        return;
+
+                    i = nextToClaim++;
+                }
+
+                T result = work(i);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slots[i % window] = std::move(result);
+                }
+
+                resultReady.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < jobs; t++)
+            threads.emplace_back(worker);
+
+        for (size_t i = 0; i < n; i++) {
+            T result;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                resultReady.wait(lock, [&] { return slots[i % window].has_value(); });
+                result = std::move(*slots[i % window]);
+                slots[i % window].reset();
+                nextToDeliver = i + 1;
+            }
+
+            slotFree.notify_all();
+            deliver(i, std::move(result));
+        }
+
+        for (auto &t : threads)
+            t.join();
+    }
+
+    // How full a queue was, to tell which side of it is the bottleneck:
+    // a queue that is mostly full waits for its consumer, one that is
+    // mostly empty waits for its producer
+    struct QueueStats {
+        size_t capacity = 0;
+        size_t maxDepth = 0;
+        double depthSum = 0;            // sampled at each push
+        unsigned long pushCount = 0;
+        unsigned long producerWaits = 0; // pushes that found the queue full
+        unsigned long consumerWaits = 0; // pops that found the queue empty
+
+        double averageDepth() const {
+            return (pushCount > 0) ? depthSum / pushCount : 0;
+        }
+    };
+
+    // FIFO between two stages of a pipeline
+    // push() blocks while the queue is full, pop() while it's empty.
+    // After close() pop() returns the remaining items, then nothing.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity)
+        {
+            stats.capacity = (capacity > 0) ? capacity : 1;
+        }
+
+        void push(T &&item)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (items.size() >= stats.capacity)
+                    stats.producerWaits++;
+
+                notFull.wait(lock, [&] { return items.size() < stats.capacity; });
+                items.push_back(std::move(item));
+                sample();
+            }
+
+            notEmpty.notify_one();
+        }
+
+        std::optional<T> pop()
+        {
+            std::optional<T> item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (items.empty() && !closed)
+                    stats.consumerWaits++;
+
+                notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+                if (items.empty())
+                    return item;
+
+                item = std::move(items.front());
+                items.pop_front();
+            }
+
+            notFull.notify_one();
+            return item;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+
+            notEmpty.notify_all();
+        }
+
+        QueueStats getStats()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        void sample()
+        {
+            stats.pushCount++;
+            stats.depthSum += items.size();
+            if (items.size() > stats.maxDepth)
+                stats.maxDepth = items.size();
+        }
+
+        std::deque<T> items;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        QueueStats stats;
+    };
+
+    // Puts back in sequence the items produced out of order by several threads
+    // Items must be numbered 0, 1, 2... without gaps; push() blocks while
+    // seq is 'window' or more ahead of the next item to pop, pop() until
+    // the next item in sequence arrives.
+    // After close() pop() returns nothing once the next item is missing.
+    template <typename T>
+    class ReorderQueue
+    {
+    public:
+        explicit ReorderQueue(size_t window)
+        : slots((window > 0) ? window : 1)
+        {
+            stats.capacity = slots.size();
+        }
+
+        void push(size_t seq, T &&item)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (seq >= nextToPop + slots.size())
+                    stats.producerWaits++;
+
+                slotFree.wait(lock, [&] { return seq < nextToPop + slots.size(); });
+                slots[seq % slots.size()] = std::move(item);
+                depth++;
+                stats.pushCount++;
+                stats.depthSum += depth;
+                if (depth > stats.maxDepth)
+                    stats.maxDepth = depth;
+            }
+
+            itemReady.notify_all();
+        }
+
+        std::optional<T> pop()
+        {
+            std::optional<T> item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                std::optional<T> &slot = slots[nextToPop % slots.size()];
+                if (!slot && !closed)
+                    stats.consumerWaits++;
+
+                itemReady.wait(lock, [&] { return slot.has_value() || closed; });
+                if (!slot)
+                    return item;
+
+                item = std::move(slot);
+                slot.reset();
+                nextToPop++;
+                depth--;
+            }
+
+            slotFree.notify_all();
+            return item;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+
+            itemReady.notify_all();
+        }
+
+        QueueStats getStats()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return stats;
+        }
+
+    private:
+        std::vector<std::optional<T>> slots;
+        size_t nextToPop = 0;
+        size_t depth = 0;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable itemReady;
+        std::condition_variable slotFree;
+        QueueStats stats;
+    };
+
+    // Runs each task on its own thread, as soon as the tasks it depends on
+    // have finished. Used to load independent input files at the same time.
+    class TaskGraph
+    {
+    public:
+        struct Timing {
+            std::string name;
+            double start = 0;       // seconds after run()
+            double seconds = 0;
+        };
+
+        ~TaskGraph()
+        {
+            for (auto &t : threads)
+                if (t.joinable())
+                    t.join();
+        }
+
+        // The dependencies must have been added before, which rules out cycles
+        // No task can be added after run()
+        void add(const std::string &name,
+                 const std::vector<std::string> &dependencies,
+                 std::function<void()> task)
+        {
+            Node node;
+            node.timing.name = name;
+            node.task = task;
+            for (auto d : dependencies) {
+                size_t i = find(d);
+                if (i == nodes.size()) {
+                    std::cerr << basename((char *)__FILE__) << ":" << __LINE__
+                              << ", task " << name << ", unknown dependency " << d << std::endl;
+                    continue;
+                }
+
+                node.dependencies.push_back(i);
+            }
+
+            nodes.push_back(node);
+        }
+
+        void run()
+        {
+            startTime = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < nodes.size(); i++)
+                threads.emplace_back([this, i] { runNode(i); });
+        }
+
+        // Names that were never added are considered done
+        void wait(const std::vector<std::string> &names)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (auto name : names) {
+                size_t i = find(name);
+                if (i < nodes.size())
+                    taskDone.wait(lock, [&] { return nodes[i].done; });
+            }
+        }
+
+        void waitAll()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (auto &node : nodes)
+                taskDone.wait(lock, [&] { return node.done; });
+        }
+
+        // In the order of add()
+        std::vector<Timing> getTimings()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<Timing> timings;
+            for (auto &node : nodes)
+                timings.push_back(node.timing);
+
+            return timings;
+        }
+
+    private:
+        struct Node {
+            std::vector<size_t> dependencies;
+            std::function<void()> task;
+            bool done = false;
+            Timing timing;
+        };
+
+        size_t find(const std::string &name) const
+        {
+            for (size_t i = 0; i < nodes.size(); i++)
+                if (nodes[i].timing.name == name)
+                    return i;
+
+            return nodes.size();
+        }
+
+        double secondsSinceStart() const
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+            return elapsed.count();
+        }
+
+        void runNode(size_t i)
+        {
+            Node &node = nodes[i];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                for (auto d : node.dependencies)
+                    taskDone.wait(lock, [&] { return nodes[d].done; });
+            }
+
+            double start = secondsSinceStart();
+            node.task();
+            double end = secondsSinceStart();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                node.timing.start = start;
+                node.timing.seconds = end - start;
+                node.done = true;
+            }
+
+            taskDone.notify_all();
+        }
+
+        std::vector<Node> nodes;
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable taskDone;
+        std::chrono::steady_clock::time_point startTime;
+    };
+}
+
+#endif /* parallel_hpp */
@@ -7,6 +7,11 @@
 //  Created by Alex Bettarini on 10 May 2019
 
 #include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <libgen.h>     // for basename()
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -16,6 +21,8 @@
 #include "swissmedic2.hpp"
 #include "bag.hpp"
 #include "report.hpp"
+#include "parallel.hpp"
+#include "loader.hpp"
 #include "config.h"
 
 namespace po = boost::program_options;
@@ -44,6 +51,7 @@ int main(int argc, char **argv)
     std::string opt_inputDirectory;
     std::string opt_workDirectory;  // for downloads subdirectory
     bool flagVerbose = false;
+    unsigned int opt_jobs = 0;
     
     po::options_description desc("Allowed options");
     desc.add_options()
@@ -52,6 +60,7 @@ int main(int argc, char **argv)
     ("verbose", "be extra verbose") // Show errors and logs
     ("inDir", po::value<std::string>( &opt_inputDirectory )->required(), "input directory") //  without trailing '/'
     ("workDir", po::value<std::string>( &opt_workDirectory ), "parent of 'downloads' and 'output' directories, default as parent of inDir ")
+    ("jobs", po::value<unsigned int>( &opt_jobs )->default_value(0), "number of threads creating the CSV, 0 for one per core")
     ;
     
     po::variables_map vm;
@@ -89,6 +98,9 @@ int main(int argc, char **argv)
         flagVerbose = true;
     }
     
+    if (opt_jobs == 0)
+        opt_jobs = PAR::defaultJobs();
+
     if (!vm.count("workDir")) {
         opt_workDirectory = opt_inputDirectory + "/..";
     }
@@ -108,14 +120,58 @@ int main(int argc, char **argv)
     REP::html_h1("File Analysis");
 
     // Read input files
+    // They don't depend on each other, so they are all loaded at the same time,
+    // the two workbooks in particular. Their report sections are kept in memory
+    // and printed in this order
     const std::string language("de");
-    SWISSMEDIC1::parseXLXS(opt_workDirectory + "/downloads/swissmedic_packages.xlsx");
-    SWISSMEDIC2::parseXLXS(opt_workDirectory + "/downloads/Erweiterte_Arzneimittelliste HAM.xlsx");
-    BAG::parseXML(opt_workDirectory + "/downloads/bag_preparations.xml", language, false);
-    REFDATA::parseXML(opt_workDirectory + "/downloads/refdata_pharma.xml", language);
+    LOADER::prefetch({
+        opt_workDirectory + "/downloads/swissmedic_packages.xlsx",
+        opt_workDirectory + "/downloads/Erweiterte_Arzneimittelliste HAM.xlsx",
+        opt_workDirectory + "/downloads/bag_preparations.xml",
+        opt_workDirectory + "/downloads/refdata_pharma.xml"
+    });
+
+    const std::vector<std::string> sourceOrder {"SWISSMEDIC1", "SWISSMEDIC2", "BAG", "REFDATA"};
+    std::map<std::string, std::string> sourceReportMap;
+    std::mutex sourceReportMutex;
+    PAR::TaskGraph loaders;
+    auto addLoader = [&](const std::string &name,
+                         std::function<void()> load) {
+        loaders.add(name, {}, [&, name, load] {
+            REP::beginBuffer();
+            load();
+            std::string html = REP::endBuffer();
+
+            std::lock_guard<std::mutex> lock(sourceReportMutex);
+            sourceReportMap[name] = html;
+        });
+    };
+
+    addLoader("SWISSMEDIC1", [&] {
+        SWISSMEDIC1::parseXLXS(opt_workDirectory + "/downloads/swissmedic_packages.xlsx");
+    });
+
+    addLoader("SWISSMEDIC2", [&] {
+        SWISSMEDIC2::parseXLXS(opt_workDirectory + "/downloads/Erweiterte_Arzneimittelliste HAM.xlsx");
+    });
+
+    addLoader("BAG", [&] {
+        BAG::parseXML(opt_workDirectory + "/downloads/bag_preparations.xml", {language}, false);
+    });
+
+    addLoader("REFDATA", [&] {
+        REFDATA::parseXML(opt_workDirectory + "/downloads/refdata_pharma.xml", language);
+    });
+
+    loaders.run();
+    loaders.waitAll();
+    for (auto name : sourceOrder)
+        REP::html_raw(sourceReportMap[name]);
+
+    LOADER::printFileStats();
 
     // Create CSV
-    SWISSMEDIC1::createCSV(opt_workDirectory + "/output");
+    SWISSMEDIC1::createCSV(opt_workDirectory + "/output", opt_jobs);
     
     // Usage report
     REP::html_h1("Usage");
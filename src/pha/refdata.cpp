@@ -8,6 +8,8 @@
 //
 
 #include <set>
+#include <map>
+#include <unordered_map>
 #include <libgen.h>     // for basename()
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
@@ -20,12 +22,17 @@
 #include "swissmedic1.hpp"
 #include "beautify.hpp"
 #include "report.hpp"
+#include "loader.hpp"
 
 namespace pt = boost::property_tree;
 
 namespace REFDATA
 {
     ArticleList artList;
+
+    // Built by parseXML(), read-only afterwards
+    std::multimap<std::string, size_t> gtin5Map;        // articles of a regnr, in file order
+    std::unordered_map<std::string, size_t> gtinMap;    // first article with the GTIN
     
     unsigned int statsArticleChildCount = 0;
     unsigned int statsItemCount = 0;
@@ -55,6 +62,16 @@ void printUsageStats()
     REP::html_end_ul();
 }
 
+// nullptr if there is no article with the GTIN
+static const Article * findArticle(const std::string &gtin)
+{
+    auto search = gtinMap.find(gtin);
+    if (search == gtinMap.end())
+        return nullptr;
+
+    return &artList[search->second];
+}
+
 void parseXML(const std::string &filename,
               const std::string &language)
 {
@@ -63,7 +80,9 @@ void parseXML(const std::string &filename,
 
     try {
         std::clog << std::endl << "Reading refdata XML" << std::endl;
-        pt::read_xml(filename, tree);
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        pt::read_xml(stream, tree);
     }
     catch (std::exception &e) {
         std::cerr << "Line: " << __LINE__ << " Error " << e.what() << std::endl;
@@ -98,7 +117,9 @@ void parseXML(const std::string &filename,
                 article.name = v.second.get<std::string>(nameTag, "");
                 BEAUTY::beautifyName(article.name);
 
-                artList.push_back(article);
+                gtin5Map.emplace(article.gtin_5, artList.size());
+                gtinMap.emplace(article.gtin_13, artList.size());
+                artList.push_back(std::move(article));
             }
 //            else {
 //                // one "<xmlattr>" and one "RESULT"
@@ -123,26 +144,27 @@ int getNames(const std::string &rn,
 {
     int countAdded = 0;
 
-    for (Article art : artList) {
-        if (art.gtin_5 == rn) {
-            countAdded++;
-            statsTotalGtinCount++;
-            
-            std::string onePackageInfo;
+    auto range = gtin5Map.equal_range(rn);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Article &art = artList[it->second];
+        countAdded++;
+        statsTotalGtinCount++;
+        
+        std::string onePackageInfo;
 #ifdef DEBUG_IDENTIFY_NAMES
-            onePackageInfo += "ref+";
+        onePackageInfo += "ref+";
 #endif
-            onePackageInfo += art.name;
+        onePackageInfo += art.name;
 
-            std::string cat = SWISSMEDIC1::getCategoryByGtin(art.gtin_13);
-            std::string paf = BAG::getPricesAndFlags(art.gtin_13, "", cat);
-            if (!paf.empty())
-                onePackageInfo += paf;
+        std::string cat = SWISSMEDIC1::getCategoryByGtin(art.gtin_13);
+        std::string paf = BAG::getPricesAndFlags(art.gtin_13, "", cat);
+        if (!paf.empty())
+            onePackageInfo += paf;
 
-            gtinUsed.insert(art.gtin_13);
-            packages.gtin.push_back(art.gtin_13);
-            packages.name.push_back(onePackageInfo);
-        }
+        gtinUsed.insert(art.gtin_13);
+        packages.gtin.push_back(art.gtin_13);
+        packages.name.push_back(onePackageInfo);
+        packages.category.push_back(cat);
     }
     
     return countAdded;
@@ -150,11 +172,7 @@ int getNames(const std::string &rn,
     
 bool findGtin(const std::string &gtin)
 {
-    for (Article art : artList)
-        if (art.gtin_13 == gtin)
-            return true;
-
-    return false;
+    return gtinMap.find(gtin) != gtinMap.end();
 }
 
 //std::string getPharByGtin(const std::string &gtin)
@@ -170,16 +188,11 @@ bool findGtin(const std::string &gtin)
 //    return phar;
 //}
 
-std::string getNameByGtin(const std::string &gtin)
+// Empty if not found
+const std::string & getNameByGtin(const std::string &gtin)
 {
-    std::string name;
-    
-    for (Article art : artList)
-        if (art.gtin_13 == gtin) {
-            name = art.name;
-            break;
-        }
-    
-    return name;
+    static const std::string empty;
+    const Article *art = findArticle(gtin);
+    return art ? art->name : empty;
 }
 }
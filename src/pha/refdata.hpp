@@ -37,7 +37,7 @@ namespace REFDATA
     bool findGtin(const std::string &gtin);
 
     //std::string getPharByGtin(const std::string &gtin);
-    std::string getNameByGtin(const std::string &gtin);
+    const std::string & getNameByGtin(const std::string &gtin);
 
     void printUsageStats();
 }
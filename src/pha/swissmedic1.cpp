@@ -9,6 +9,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
 #include <libgen.h>     // for basename()
 #include <regex>
 #include <boost/algorithm/string.hpp>
@@ -22,6 +27,8 @@
 //#include "beautify.hpp"
 #include "report.hpp"
 #include "refdata.hpp"
+#include "loader.hpp"
+#include "parallel.hpp"
 
 #define COLUMN_A        0   // GTIN (5 digits)
 #define COLUMN_B        1   // dosage number
@@ -42,6 +49,9 @@
 
 #define OUTPUT_FILE_SEPARATOR   ";"
 
+#define CSV_CHUNK_SIZE          256                 // rows formatted by one thread at a time
+#define CSV_WRITE_SIZE          (4 * 1024 * 1024)   // bytes
+
 #define DEBUG_DOSAGE_REGEX
 
 #ifdef DEBUG_DOSAGE_REGEX
@@ -140,7 +150,11 @@ void printUsageStats()
 void parseXLXS(const std::string &filename)
 {
     xlnt::workbook wb;
-    wb.load(filename);
+    {
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        wb.load(stream);
+    }
     auto ws = wb.active_sheet();
     
     auto date_format = wb.create_format().number_format(xlnt::number_format{"dd.mm.yyyy"}, xlnt::optional<bool>(true));
@@ -383,7 +397,7 @@ std::string getCategoryByGtin(const std::string &g)
 std::string getDosageFromName(const std::string &name)
 {
     std::string dosage;
-    std::regex rgx(R"(\d+(\.\d+)?\s*(mg|g(\s|$)|i.u.|e(\s|$)|mcg|ie|mmol)(\s?\/\s?(\d(\.\d+)?)*\s*(ml|g|mcg))*)");  // tested at https://regex101.com
+    static const std::regex rgx(R"(\d+(\.\d+)?\s*(mg|g(\s|$)|i.u.|e(\s|$)|mcg|ie|mmol)(\s?\/\s?(\d(\.\d+)?)*\s*(ml|g|mcg))*)");  // tested at https://regex101.com
     std::smatch match;
     if (std::regex_search(name, match, rgx))
         dosage = match[0];
@@ -404,46 +418,31 @@ std::string getDosageFromName(const std::string &name)
 //    return du;
 //}
 
-void createCSV(const std::string &outDir)
+struct csvChunk {
+    std::string text;
+#ifdef DEBUG_DOSAGE_REGEX
+    std::vector<std::string> dosageChecks;
+#endif
+};
+
+// Rows [first, last) of pharma.csv
+// Only reads the parsed data, so that several chunks can be formatted at the same time
+static
+csvChunk formatRows(size_t first, size_t last,
+                    const std::unordered_map<std::string, std::string> &categoryMap)
 {
-    std::ofstream ofs;
-    std::string filename = outDir + "/pharma.csv";
-    ofs.open(filename);
- 
-    std::clog << std::endl << "Creating CSV" << std::endl;
+    csvChunk chunk;
+    std::ostringstream ofs;
 
-    ofs
-    << "Registrierungsnummer" << OUTPUT_FILE_SEPARATOR  // A
-    << "Packungsnummer" << OUTPUT_FILE_SEPARATOR        // B
-    << "Swissmedicnummer" << OUTPUT_FILE_SEPARATOR      // C
-    << "GTIN" << OUTPUT_FILE_SEPARATOR                  // D
-    << "Präparat" << OUTPUT_FILE_SEPARATOR              // E
-    << "Galenische Form" << OUTPUT_FILE_SEPARATOR       // F
-    << "Dosierung" << OUTPUT_FILE_SEPARATOR             // G
-    << "Packungsgrösse" << OUTPUT_FILE_SEPARATOR        // H
-    << "Packungsgrösse numerisch" << OUTPUT_FILE_SEPARATOR // I
-    << "EFP" << OUTPUT_FILE_SEPARATOR                   // J
-    << "PP" << OUTPUT_FILE_SEPARATOR                    // K
-    << "Zulassungsinhaber" << OUTPUT_FILE_SEPARATOR     // L
-    << "Swissmedic Kategorie" << OUTPUT_FILE_SEPARATOR  // M
-    << "SL Produkt:" << OUTPUT_FILE_SEPARATOR           // N
-    << "Aufnahmedatum SL" << OUTPUT_FILE_SEPARATOR      // O
-    << "Registrierungsdatum" << OUTPUT_FILE_SEPARATOR   // P
-    << "Gültigkeitsdatum" << OUTPUT_FILE_SEPARATOR      // Q
-    << "Exportprodukt" << OUTPUT_FILE_SEPARATOR         // R
-    << "Generikum" << OUTPUT_FILE_SEPARATOR             // S
-    << "Index Therapeuticus (BAG)" << OUTPUT_FILE_SEPARATOR // T
-    << "Index Therapeuticus (Swissmedic)" << OUTPUT_FILE_SEPARATOR // U
-    << "Betäubungsmittel" << OUTPUT_FILE_SEPARATOR      // V
-    << "Impfstoff/Blutprodukt" << OUTPUT_FILE_SEPARATOR // W
-    << "Tageskosten (DDD)"                              // X
-    << std::endl;
-    
-    for (auto pv : pharmaVec) {
+    for (size_t i = first; i < last; i++) {
+        const pharmaRow &pv = pharmaVec[i];
+
+        std::string cat;
+        auto search = categoryMap.find(pv.gtin13);
+        if (search != categoryMap.end())
+            cat = search->second;
 
-        std::string cat = getCategoryByGtin(pv.gtin13);
-        std::string paf = BAG::getPricesAndFlags(pv.gtin13, "", cat);
-        BAG::packageFields fromBag = BAG::getPackageFieldsByGtin(pv.gtin13);
+        BAG::packageFields fromBag = BAG::getPackageFieldsByGtin(pv.gtin13, cat);
         std::string auth = SWISSMEDIC2::getAuthorizationByAtc(pv.rn5, pv.dosageNr);
         
         // Take the name first from Refdata based on GTIN
@@ -453,13 +452,9 @@ void createCSV(const std::string &outDir)
 
         std::string dosage = getDosageFromName(name);
 #ifdef DEBUG_DOSAGE_REGEX
-        static int k=1;
-        if (atcTestSet.find(std::stol(pv.gtin13)) != atcTestSet.end()) {
-            std::clog << k++ << "."
-            << "\t <" << name << ">"
-            << "\t\t\t <" << dosage << ">"
-            << std::endl;
-        }
+        // Printed in order by createCSV()
+        if (atcTestSet.find(std::stol(pv.gtin13)) != atcTestSet.end())
+            chunk.dosageChecks.push_back("\t <" + name + ">" + "\t\t\t <" + dosage + ">");
 #endif
 
         
@@ -502,11 +497,116 @@ void createCSV(const std::string &outDir)
         << pv.narcoticFlag << OUTPUT_FILE_SEPARATOR // V
         << OUTPUT_FILE_SEPARATOR // W
         << "" // X
-        << std::endl;
+        << "\n";
     }
-    
+
+    chunk.text = ofs.str();
+    return chunk;
+}
+
+static
+void printCsvStats(const std::string &filename,
+                   size_t rows,
+                   size_t bytes,
+                   unsigned int jobs,
+                   double seconds)
+{
+    std::ostringstream time;
+    time << std::fixed << std::setprecision(3) << seconds;
+    std::ostringstream throughput;
+    throughput << std::fixed << std::setprecision(0) << ((seconds > 0) ? rows / seconds : 0);
+
+    REP::html_h2("pharma.csv");
+    REP::html_p(filename);
+    REP::html_start_ul();
+    REP::html_li("rows: " + std::to_string(rows));
+    REP::html_li("size: " + std::to_string(bytes / 1024) + " KB");
+    REP::html_li("threads: " + std::to_string(jobs));
+    REP::html_li("created in " + time.str() + " s, " + throughput.str() + " rows/s");
+    REP::html_end_ul();
+}
+
+void createCSV(const std::string &outDir, unsigned int jobs)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::ofstream ofs;
+    std::string filename = outDir + "/pharma.csv";
+    ofs.open(filename);
+ 
+    std::clog << std::endl << "Creating CSV" << std::endl;
+
+    // The whole file is built here and written in a few big writes
+    std::string out;
+    out.reserve(CSV_WRITE_SIZE + CSV_WRITE_SIZE / 4);
+    size_t bytesWritten = 0;
+
+    std::ostringstream header;
+    header
+    << "Registrierungsnummer" << OUTPUT_FILE_SEPARATOR  // A
+    << "Packungsnummer" << OUTPUT_FILE_SEPARATOR        // B
+    << "Swissmedicnummer" << OUTPUT_FILE_SEPARATOR      // C
+    << "GTIN" << OUTPUT_FILE_SEPARATOR                  // D
+    << "Präparat" << OUTPUT_FILE_SEPARATOR              // E
+    << "Galenische Form" << OUTPUT_FILE_SEPARATOR       // F
+    << "Dosierung" << OUTPUT_FILE_SEPARATOR             // G
+    << "Packungsgrösse" << OUTPUT_FILE_SEPARATOR        // H
+    << "Packungsgrösse numerisch" << OUTPUT_FILE_SEPARATOR // I
+    << "EFP" << OUTPUT_FILE_SEPARATOR                   // J
+    << "PP" << OUTPUT_FILE_SEPARATOR                    // K
+    << "Zulassungsinhaber" << OUTPUT_FILE_SEPARATOR     // L
+    << "Swissmedic Kategorie" << OUTPUT_FILE_SEPARATOR  // M
+    << "SL Produkt:" << OUTPUT_FILE_SEPARATOR           // N
+    << "Aufnahmedatum SL" << OUTPUT_FILE_SEPARATOR      // O
+    << "Registrierungsdatum" << OUTPUT_FILE_SEPARATOR   // P
+    << "Gültigkeitsdatum" << OUTPUT_FILE_SEPARATOR      // Q
+    << "Exportprodukt" << OUTPUT_FILE_SEPARATOR         // R
+    << "Generikum" << OUTPUT_FILE_SEPARATOR             // S
+    << "Index Therapeuticus (BAG)" << OUTPUT_FILE_SEPARATOR // T
+    << "Index Therapeuticus (Swissmedic)" << OUTPUT_FILE_SEPARATOR // U
+    << "Betäubungsmittel" << OUTPUT_FILE_SEPARATOR      // V
+    << "Impfstoff/Blutprodukt" << OUTPUT_FILE_SEPARATOR // W
+    << "Tageskosten (DDD)"                              // X
+    << "\n";
+    out += header.str();
+
+    // Same result as getCategoryByGtin(), the first row with the GTIN wins,
+    // without scanning pharmaVec for each row
+    std::unordered_map<std::string, std::string> categoryMap;
+    categoryMap.reserve(pharmaVec.size());
+    for (auto &pv : pharmaVec)
+        categoryMap.emplace(pv.gtin13, pv.category);
+
+    size_t chunkCount = (pharmaVec.size() + CSV_CHUNK_SIZE - 1) / CSV_CHUNK_SIZE;
+#ifdef DEBUG_DOSAGE_REGEX
+    int k=1;
+#endif
+    PAR::orderedForEach<csvChunk>(chunkCount, jobs, 4 * jobs,
+        [&](size_t i) {
+            size_t first = i * CSV_CHUNK_SIZE;
+            size_t last = std::min(first + CSV_CHUNK_SIZE, pharmaVec.size());
+            return formatRows(first, last, categoryMap);
+        },
+        [&](size_t, csvChunk &&chunk) {
+#ifdef DEBUG_DOSAGE_REGEX
+            for (auto &check : chunk.dosageChecks)
+                std::clog << k++ << "." << check << std::endl;
+#endif
+            out += chunk.text;
+            if (out.size() >= CSV_WRITE_SIZE) {
+                ofs.write(out.data(), out.size());
+                bytesWritten += out.size();
+                out.clear();
+            }
+        });
+
+    ofs.write(out.data(), out.size());
+    bytesWritten += out.size();
     ofs.close();
-    
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printCsvStats(filename, pharmaVec.size(), bytesWritten, jobs, elapsed.count());
+
     std::clog << std::endl << "Created " << filename << std::endl;
 }
 }
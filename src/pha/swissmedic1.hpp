@@ -37,7 +37,8 @@ namespace SWISSMEDIC1
 
     void parseXLXS(const std::string &filename);
     
-    void createCSV(const std::string &outDir);
+    // Rows are formatted on 'jobs' threads and written in order
+    void createCSV(const std::string &outDir, unsigned int jobs);
 
 //    int getAdditionalNames(const std::string &rn,
 //                           std::set<std::string> &gtinUsed,
@@ -10,11 +10,13 @@
 // Tgere is no GTIN. We match it to swissmedic 1 via column A
 
 #include <iostream>
+#include <unordered_map>
 
 #include <xlnt/xlnt.hpp>
 
 #include "swissmedic2.hpp"
 #include "gtin.hpp"
+#include "loader.hpp"
 
 #define COLUMN_A        0   // GTIN (5 digits)
 #define COLUMN_B        1   // dosage number
@@ -26,11 +28,24 @@
 namespace SWISSMEDIC2
 {
     std::vector<pharmaExtraRow> pharmaExtraVec;
+
+    // Built by parseXLXS(), read-only afterwards
+    // key is rn5 and dosage number, value is the first row with them
+    std::unordered_map<std::string, size_t> authorizationMap;
+
+static std::string authorizationKey(const std::string &rn5, const std::string &dn)
+{
+    return rn5 + "|" + dn;
+}
     
 void parseXLXS(const std::string &filename)
 {
     xlnt::workbook wb;
-    wb.load(filename);
+    {
+        LOADER::Buffer buffer = LOADER::take(filename);
+        LOADER::BufferStream stream(*buffer);
+        wb.load(stream);
+    }
     auto ws = wb.active_sheet();
     
     std::clog << std::endl << "Reading swissmedic extended XLSX" << std::endl;
@@ -66,20 +81,22 @@ void parseXLXS(const std::string &filename)
         
         pharmaExtraVec.push_back(pxr);
     }
+
+    for (size_t i = 0; i < pharmaExtraVec.size(); i++) {
+        const pharmaExtraRow &px = pharmaExtraVec[i];
+        authorizationMap.emplace(authorizationKey(px.rn5, px.dosageNr), i);
+    }
 }
     
-std::string getAuthorizationByAtc(const std::string &atc, const std::string &dn)
+const std::string & getAuthorizationByAtc(const std::string &atc, const std::string &dn)
 {
-    std::string auth;
-    
-    for (auto px : pharmaExtraVec) {
-        if ((px.rn5 == atc) && (px.dosageNr == dn)){
-            auth = px.authType;
-            break;
-        }
-    }
-    
-    return auth;
+    static const std::string empty;
+
+    auto search = authorizationMap.find(authorizationKey(atc, dn));
+    if (search == authorizationMap.end())
+        return empty;
+
+    return pharmaExtraVec[search->second].authType;
 }
 
 }
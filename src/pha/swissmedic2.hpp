@@ -19,6 +19,6 @@ namespace SWISSMEDIC2
     };
 
     void parseXLXS(const std::string &filename);
-    std::string getAuthorizationByAtc(const std::string &atc, const std::string &dn);
+    const std::string & getAuthorizationByAtc(const std::string &atc, const std::string &dn);
 }
 #endif
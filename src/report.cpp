@@ -13,6 +13,9 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <sstream>
+#include <memory>
+#include <mutex>
 #include <ctime>
 #include <libgen.h>     // for basename()
 
@@ -26,9 +29,23 @@
 namespace REP
 {
     std::ofstream ofs2;
-    std::vector<std::string> ul;
+    std::mutex ofsMutex;
+    thread_local std::vector<std::string> ul;
+    thread_local std::unique_ptr<std::ostringstream> buffer;
     bool verboseFlag;
 
+// To the buffer of this thread if there is one, otherwise to the file
+static void writeLine(const std::string &line)
+{
+    if (buffer) {
+        *buffer << line << std::endl;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(ofsMutex);
+    ofs2 << line << std::endl;
+}
+
 static void sanitize(std::string &msg)
 {
     boost::replace_all(msg, "<", "&lt;");
@@ -87,29 +104,29 @@ void terminate()
 void html_start_ul()
 {
     ul.clear();
-    ofs2 << "<ul>" << std::endl;
+    writeLine("<ul>");
 }
 
 void html_start_ol()
 {
     ul.clear();
-    ofs2 << "<ol>" << std::endl;
+    writeLine("<ol>");
 }
 
 void html_end_ul()
 {
     for (auto bullet : ul)
-        ofs2 << bullet << std::endl;
+        writeLine(bullet);
 
-    ofs2 << "</ul>" << std::endl;
+    writeLine("</ul>");
 }
     
 void html_end_ol()
 {
     for (auto bullet : ul)
-        ofs2 << bullet << std::endl;
+        writeLine(bullet);
     
-    ofs2 << "</ol>" << std::endl;
+    writeLine("</ol>");
 }
     
 void html_h1(const std::string &msg)
@@ -118,7 +135,7 @@ void html_h1(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<hr><h1>" << s << "</h1>" << std::endl;
+    writeLine("<hr><h1>" + s + "</h1>");
 }
 
 void html_h2(const std::string &msg)
@@ -127,7 +144,7 @@ void html_h2(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<hr><h2>" << s << "</h2>" << std::endl;
+    writeLine("<hr><h2>" + s + "</h2>");
 }
 
 void html_h3(const std::string &msg)
@@ -136,7 +153,7 @@ void html_h3(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<h3>" << s << "</h3>" << std::endl;
+    writeLine("<h3>" + s + "</h3>");
 }
 
 void html_h4(const std::string &msg)
@@ -145,7 +162,7 @@ void html_h4(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<h4>" << s << "</h4>" << std::endl;
+    writeLine("<h4>" + s + "</h4>");
 }
 
 void html_p(const std::string &msg)
@@ -154,7 +171,7 @@ void html_p(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<p>" << s << "</p>" << std::endl;
+    writeLine("<p>" + s + "</p>");
 }
 
 void html_div(const std::string &msg)
@@ -163,7 +180,7 @@ void html_div(const std::string &msg)
 
     std::string s(msg);
     sanitize(s);
-    ofs2 << "<div>" << s << "</div>" << std::endl;
+    writeLine("<div>" + s + "</div>");
 }
 
 void html_li(const std::string &msg)
@@ -175,4 +192,32 @@ void html_li(const std::string &msg)
     ul.push_back("<li>" + s + "</li>");
 }
 
+void beginBuffer()
+{
+    buffer.reset(new std::ostringstream);
+}
+
+std::string endBuffer()
+{
+    std::string html;
+    if (buffer) {
+        html = buffer->str();
+        buffer.reset();
+    }
+
+    return html;
+}
+
+void html_raw(const std::string &html)
+{
+    if (html.empty())
+        return;
+
+    std::string s(html);
+    if (s.back() == '\n')
+        s.pop_back();
+
+    writeLine(s);
+}
+
 }
@@ -33,6 +33,14 @@ namespace REP
     void html_end_ul();
     void html_end_ol();
     void html_li(const std::string &msg);
+
+    // Until endBuffer() the output of the calling thread is kept in memory,
+    // so that the sections of files loaded in parallel don't get mixed up
+    void beginBuffer();
+    std::string endBuffer();
+
+    // Output of endBuffer(), already HTML
+    void html_raw(const std::string &html);
     
 //    // http://www.drdobbs.com/cpp/logging-in-c/201804215
 //    class Log